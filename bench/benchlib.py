@@ -0,0 +1,155 @@
+"""Helpers shared by the tinyterm benchmark drivers.
+
+Runs tinyterm under a private headless X server, parses the ``--timing``
+output and compares results against a saved JSON baseline.
+"""
+
+import json
+import math
+import os
+import re
+import shutil
+import subprocess
+import sys
+import time
+
+TIMING_RE = re.compile(r"^timing: (.+?)\s+(-?[\d.]+) ms\s+\(total\s+(-?[\d.]+) ms\)$")
+FRAMES_RE = re.compile(r"^timing: (\d+) frames drawn$")
+
+
+class HeadlessX:
+    """Xvfb on the first free display, torn down on exit."""
+
+    def __init__(self, geometry="1280x1024x24"):
+        self.geometry = geometry
+        self.proc = None
+        self.display = None
+
+    def __enter__(self):
+        if not shutil.which("Xvfb"):
+            sys.exit("Xvfb not found; install it or pass --display to use a running X server")
+        for num in range(90, 200):
+            if os.path.exists("/tmp/.X11-unix/X%d" % num) or os.path.exists("/tmp/.X%d-lock" % num):
+                continue
+            self.proc = subprocess.Popen(
+                ["Xvfb", ":%d" % num, "-screen", "0", self.geometry, "-nolisten", "tcp"],
+                stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+            for _ in range(100):
+                if os.path.exists("/tmp/.X11-unix/X%d" % num):
+                    self.display = ":%d" % num
+                    return self
+                if self.proc.poll() is not None:
+                    break
+                time.sleep(0.05)
+            self.proc.kill()
+        sys.exit("failed to start Xvfb")
+
+    def __exit__(self, *exc):
+        self.proc.terminate()
+        self.proc.wait()
+
+
+def x_display(args):
+    """Context manager for the display selected on the command line."""
+    if args.display:
+        class Existing:
+            display = args.display
+            def __enter__(self):
+                return self
+            def __exit__(self, *exc):
+                pass
+        return Existing()
+    return HeadlessX()
+
+
+def add_common_arguments(parser):
+    parser.add_argument("--binary", default="./tinyterm", help="tinyterm binary to run")
+    parser.add_argument("--runs", type=int, default=20, help="runs per scenario")
+    parser.add_argument("--display", help="use this X display instead of a private Xvfb")
+    parser.add_argument("--save", metavar="FILE", help="write results as JSON")
+    parser.add_argument("--baseline", metavar="FILE", help="compare medians against saved JSON results")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="regression threshold in percent (default: 10)")
+
+
+def parse_timing(stderr):
+    """Map of phase -> (delta ms, total ms) from tinyterm --timing output."""
+    phases = {}
+    for line in stderr.splitlines():
+        match = TIMING_RE.match(line.strip())
+        if match and match.group(1) not in phases:
+            phases[match.group(1)] = (float(match.group(2)), float(match.group(3)))
+    return phases
+
+
+def parse_frames(stderr):
+    """Frames drawn as reported by tinyterm --timing at child exit, or None."""
+    for line in stderr.splitlines():
+        match = FRAMES_RE.match(line.strip())
+        if match:
+            return int(match.group(1))
+    return None
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile of a non-empty list."""
+    ordered = sorted(values)
+    rank = max(1, math.ceil(pct / 100.0 * len(ordered)))
+    return ordered[rank - 1]
+
+
+def summarize(values):
+    if not values:
+        return None
+    return {
+        "n": len(values),
+        "min": min(values),
+        "median": percentile(values, 50),
+        "p95": percentile(values, 95),
+        "p99": percentile(values, 99),
+    }
+
+
+def print_table(title, metrics, unit):
+    print("\n%s" % title)
+    print("  %-32s %6s %10s %10s %10s %10s" % ("metric", "n", "min", "median", "p95", "p99"))
+    for name, stats in metrics.items():
+        if stats is None:
+            print("  %-32s %6s" % (name, "-"))
+            continue
+        print("  %-32s %6d %10.3f %10.3f %10.3f %10.3f %s" % (
+            name, stats["n"], stats["min"], stats["median"], stats["p95"], stats["p99"], unit))
+
+
+def tinyterm_version(binary):
+    try:
+        out = subprocess.run([binary, "--version"], capture_output=True, text=True, timeout=10)
+        return out.stdout.strip()
+    except OSError:
+        return None
+
+
+def save_results(path, results):
+    with open(path, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+
+def compare_baseline(path, results, threshold, higher_is_better=()):
+    """Print median changes against a baseline; returns True if any metric regressed."""
+    with open(path) as f:
+        baseline = json.load(f)
+    regressed = False
+    print("\nComparison against %s (threshold %.1f%%)" % (path, threshold))
+    for scenario, metrics in results["scenarios"].items():
+        for name, stats in metrics.items():
+            old = baseline.get("scenarios", {}).get(scenario, {}).get(name)
+            if not stats or not old or not old.get("median"):
+                continue
+            change = (stats["median"] - old["median"]) / old["median"] * 100.0
+            worse = -change if name in higher_is_better else change
+            flag = "REGRESSION" if worse > threshold else ""
+            regressed = regressed or bool(flag)
+            print("  %-12s %-32s %10.3f -> %10.3f  %+7.1f%% %s" % (
+                scenario, name, old["median"], stats["median"], change, flag))
+    return regressed
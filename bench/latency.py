@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Typing latency benchmark: time keystrokes with ``tinyterm --latency-probe``.
+
+Every run sends a few thousand synthetic key events to an echo program and
+reports min/median/p99 of each stage, from the key event to the pty write,
+the read of the echo, the frame drawn and the round trip to the X server that
+follows it. The driver summarizes the medians and p99s over the runs.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+import benchlib
+
+LATENCY_RE = re.compile(r"^latency: (.+?)\s+min\s+([\d.]+) ms\s+median\s+([\d.]+) ms\s+p99\s+([\d.]+) ms$")
+
+
+def run_once(binary, env, command):
+    args = [binary, "--latency-probe"] + (["-e", command] if command else [])
+    out = subprocess.run(args, env=env, capture_output=True, text=True, timeout=600)
+    stages = {}
+    for line in out.stdout.splitlines():
+        match = LATENCY_RE.match(line.strip())
+        if match:
+            stages[match.group(1)] = (float(match.group(3)), float(match.group(4)))
+    if out.returncode != 0 or not stages:
+        sys.exit("tinyterm --latency-probe failed:\n%s%s" % (out.stdout, out.stderr))
+    return stages
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    benchlib.add_common_arguments(parser)
+    parser.set_defaults(runs=3)
+    parser.add_argument("--command", help="echo program instead of the built-in raw cat")
+    args = parser.parse_args()
+
+    results = {"tinyterm": benchlib.tinyterm_version(args.binary), "runs": args.runs, "scenarios": {}}
+    with benchlib.x_display(args) as x:
+        env = dict(os.environ, DISPLAY=x.display)
+        runs = [run_once(args.binary, env, args.command) for _ in range(args.runs)]
+
+    metrics = {}
+    for stage in runs[0]:
+        metrics["%s median ms" % stage] = benchlib.summarize([run[stage][0] for run in runs if stage in run])
+        metrics["%s p99 ms" % stage] = benchlib.summarize([run[stage][1] for run in runs if stage in run])
+    results["scenarios"]["typing"] = metrics
+    benchlib.print_table("typing latency (%d runs)" % args.runs, metrics, "")
+
+    if args.save:
+        benchlib.save_results(args.save, results)
+    if args.baseline and benchlib.compare_baseline(args.baseline, results, args.threshold):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Startup benchmark: launch tinyterm repeatedly and report --timing phases.
+
+Scenarios:
+  true   tinyterm -e true
+  shell  tinyterm -e "$SHELL -i -c exit", which also runs the shell rc files
+
+Every run uses a private Xvfb display unless --display is given, so no
+tinyterm daemon answers the request and each run is a full standalone start.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import time
+
+import benchlib
+
+SCENARIOS = {
+    "true": "true",
+    "shell": "%s -i -c exit" % os.environ.get("SHELL", "/bin/sh"),
+}
+
+
+def run_once(binary, command, env):
+    start = time.monotonic()
+    proc = subprocess.run([binary, "--timing", "-e", command], env=env,
+                          stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    wall = (time.monotonic() - start) * 1000.0
+    return wall, benchlib.parse_timing(proc.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    benchlib.add_common_arguments(parser)
+    parser.add_argument("--scenario", action="append", choices=sorted(SCENARIOS),
+                        help="run only this scenario (may be repeated)")
+    args = parser.parse_args()
+
+    results = {"tinyterm": benchlib.tinyterm_version(args.binary), "runs": args.runs, "scenarios": {}}
+    with benchlib.x_display(args) as x:
+        env = dict(os.environ, DISPLAY=x.display)
+        for scenario in args.scenario or sorted(SCENARIOS):
+            walls, phases = [], {}
+            for _ in range(args.runs):
+                wall, timing = run_once(args.binary, SCENARIOS[scenario], env)
+                walls.append(wall)
+                for phase, (delta, total) in timing.items():
+                    # cumulative times for the milestones, per-phase cost for the rest
+                    value = total if phase.startswith("first ") or phase == "child exit" else delta
+                    phases.setdefault(phase, []).append(value)
+
+            metrics = {"wall time": benchlib.summarize(walls)}
+            for phase in sorted(phases, key=lambda p: benchlib.percentile(phases[p], 50)):
+                metrics[phase] = benchlib.summarize(phases[phase])
+            results["scenarios"][scenario] = metrics
+            benchlib.print_table("tinyterm -e %r (%d runs)" % (SCENARIOS[scenario], args.runs), metrics, "ms")
+
+    if args.save:
+        benchlib.save_results(args.save, results)
+    if args.baseline and benchlib.compare_baseline(args.baseline, results, args.threshold):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
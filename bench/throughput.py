@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Output throughput benchmark: flood tinyterm with generated pty output.
+
+Each scenario writes a file of about --size MiB and runs
+``tinyterm --timing -e "cat FILE"`` on it, reporting MB/s, wall time, frames
+drawn and peak RSS of the tinyterm process:
+
+  ascii     plain 80 column ASCII lines
+  sgr256    every character in its own 256-color SGR foreground/background
+  utf8      CJK, kana and combining sequences
+  redraw    cursor-addressed full-screen redraws, as done by htop or vim
+  longline  lines of several thousand characters that wrap many times
+
+With --headless nothing is drawn, which measures the parser on its own; wall
+time then includes the 100 ms tinyterm waits for vte to settle.
+"""
+
+import argparse
+import os
+import random
+import shlex
+import subprocess
+import sys
+import tempfile
+import time
+
+import benchlib
+
+ROWS, COLS = 24, 80
+
+
+def gen_ascii(rnd):
+    line = "".join(chr(rnd.randrange(0x20, 0x7f)) for _ in range(COLS - 1))
+    return (line + "\n") * 64
+
+
+def gen_sgr256(rnd):
+    out = []
+    for _ in range(COLS - 1):
+        out.append("\x1b[38;5;%d;48;5;%dm%s" % (rnd.randrange(256), rnd.randrange(256), chr(rnd.randrange(0x21, 0x7f))))
+    return "".join(out) + "\x1b[0m\n"
+
+
+def gen_utf8(rnd):
+    pieces = ["漢字", "かなカナ", "한국어", "é", "ạ̈", "क्ष", "ñ", "—"]
+    out, width = [], 0
+    while width < COLS - 4:
+        piece = rnd.choice(pieces)
+        out.append(piece)
+        width += 2 * len(piece) if ord(piece[0]) > 0x2e80 else 1
+    return "".join(out) + "\n"
+
+
+def gen_redraw(rnd):
+    out = ["\x1b[H"]
+    for row in range(1, ROWS + 1):
+        text = "".join(chr(rnd.randrange(0x20, 0x7f)) for _ in range(COLS))
+        out.append("\x1b[%d;1H\x1b[%dm%s" % (row, 30 + row % 8, text))
+    out.append("\x1b[0m")
+    return "".join(out)
+
+
+def gen_longline(rnd):
+    length = rnd.randrange(2000, 10000)
+    return "".join(chr(rnd.randrange(0x20, 0x7f)) for _ in range(length)) + "\n"
+
+
+SCENARIOS = {
+    "ascii": gen_ascii,
+    "sgr256": gen_sgr256,
+    "utf8": gen_utf8,
+    "redraw": gen_redraw,
+    "longline": gen_longline,
+}
+
+
+def generate(path, generator, size):
+    rnd = random.Random(size)
+    chunks = [generator(rnd).encode() for _ in range(64)]
+    written = i = 0
+    with open(path, "wb") as f:
+        while written < size:
+            chunk = chunks[i % len(chunks)]
+            f.write(chunk)
+            written += len(chunk)
+            i += 1
+    return written
+
+
+def run_once(binary, path, env, headless):
+    command = [binary, "--timing", "-e", "cat %s" % shlex.quote(path)] + (["--headless"] if headless else [])
+    with tempfile.TemporaryFile(mode="w+") as stderr:
+        start = time.monotonic()
+        proc = subprocess.Popen(command, env=env,
+                                stdout=subprocess.DEVNULL, stderr=stderr)
+        _, _, rusage = os.wait4(proc.pid, 0)
+        wall = time.monotonic() - start
+        stderr.seek(0)
+        frames = benchlib.parse_frames(stderr.read())
+    return wall, frames, rusage.ru_maxrss / 1024.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    benchlib.add_common_arguments(parser)
+    parser.set_defaults(runs=5)
+    parser.add_argument("--size", type=float, default=64, help="MiB of output per scenario (default: 64)")
+    parser.add_argument("--scenario", action="append", choices=sorted(SCENARIOS),
+                        help="run only this scenario (may be repeated)")
+    parser.add_argument("--headless", action="store_true", help="run tinyterm --headless, without rendering")
+    args = parser.parse_args()
+
+    results = {"tinyterm": benchlib.tinyterm_version(args.binary), "runs": args.runs,
+               "size_mib": args.size, "headless": args.headless, "scenarios": {}}
+    with tempfile.TemporaryDirectory(prefix="tinyterm-bench-") as tmp, benchlib.x_display(args) as x:
+        env = dict(os.environ, DISPLAY=x.display)
+        for scenario in args.scenario or sorted(SCENARIOS):
+            path = os.path.join(tmp, scenario)
+            size = generate(path, SCENARIOS[scenario], int(args.size * 1024 * 1024))
+            walls, rates, frames, rss = [], [], [], []
+            for _ in range(args.runs):
+                wall, drawn, peak = run_once(args.binary, path, env, args.headless)
+                walls.append(wall * 1000.0)
+                rates.append(size / wall / 1e6)
+                rss.append(peak)
+                if drawn is not None:
+                    frames.append(drawn)
+            os.unlink(path)
+
+            metrics = {
+                "throughput MB/s": benchlib.summarize(rates),
+                "wall time ms": benchlib.summarize(walls),
+                "frames drawn": benchlib.summarize(frames),
+                "peak RSS MiB": benchlib.summarize(rss),
+            }
+            results["scenarios"][scenario] = metrics
+            benchlib.print_table("%s: %.1f MiB (%d runs)" % (scenario, size / 1048576.0, args.runs), metrics, "")
+
+    if args.save:
+        benchlib.save_results(args.save, results)
+    if args.baseline and benchlib.compare_baseline(args.baseline, results, args.threshold,
+                                                   higher_is_better=("throughput MB/s",)):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
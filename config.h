@@ -24,18 +24,52 @@
  *
  */
 
+/* Compiled-in defaults. The font, word chars, scrollback lines, bells, refresh rates, colors
+ * and keys can also be set in $XDG_CONFIG_HOME/tinyterm/config, see README.md */
+
 /* Terminal emulation (value of $TERM) (default: xterm) */
 #define TINYTERM_TERMINFO       "xterm-256color"
 
 #define TINYTERM_DYNAMIC_WINDOW_TITLE   // uncomment to enable window_title_cb
+#define TINYTERM_TITLE_INTERVAL     50  // minimum time between title updates in ms
 //#define TINYTERM_URGENT_ON_BELL         // uncomment to enable window_urgency_hint_cb
 //#define TINYTERM_SCROLLBAR_VISIBLE    // uncomment to show scrollbar
-#define TINYTERM_SCROLLBACK_LINES   10000
+#define TINYTERM_SCROLLBACK_LINES   10000     // -1 for unlimited history
+/* VTE appends the history to uncompressed, unlinked files in $TMPDIR; uncomment to put
+ * them in this directory under $XDG_RUNTIME_DIR instead, which is usually tmpfs, so the
+ * history then takes RAM (shared memory), without limit for -1 lines */
+//#define TINYTERM_SCROLLBACK_DIR     "tinyterm"
+/* File in $HOME the output of a pane is logged to by TINYTERM_KEY_LOG, as a strftime
+ * format; appended to if it exists, gzip compressed if it ends in .gz */
+#define TINYTERM_LOG_FILE           "tinyterm-%Y%m%d-%H%M%S.log"
+/* Memory budget: once the history files of all terminals of the process exceed this many
+ * bytes (0 for no limit), or some task stalled on memory for this share of the last 10 s in %
+ * (PSI, 0 to ignore), the history of the terminal focused least recently is halved every
+ * few seconds; it can grow again once the terminal is focused */
+#define TINYTERM_SCROLLBACK_BUDGET  (512 * 1024 * 1024)
+#define TINYTERM_MEMORY_PRESSURE    10
 #define TINYTERM_SEARCH_WRAP_AROUND TRUE
+#define TINYTERM_COLOR_SEARCH_FAILED "#ff8080" // search bar background without a match
 #define TINYTERM_AUDIBLE_BELL   FALSE
 #define TINYTERM_VISIBLE_BELL   FALSE
 #define TINYTERM_FONT           "monospace 11"
 
+/* Refresh rate of terminals in unfocused windows, and of obscured or unmapped windows,
+ * which aren't drawn at all; their output is still read and redrawn once when exposed */
+#define TINYTERM_UNFOCUSED_FPS      10
+#define TINYTERM_HIDDEN_FPS         1
+
+/* Daemon mode: number of hidden windows kept ready with a shell in $HOME (0 to disable)
+ * and seconds without requests after which they are closed (0 to keep them forever).
+ * Pooled shells inherit the environment of the daemon instead of the client. */
+#define TINYTERM_POOL_SIZE          2
+#define TINYTERM_POOL_IDLE_TIMEOUT  3600
+/* Daemon mode: file in $XDG_DATA_HOME the layout, working directories, commands and history
+ * of its windows are saved to every few seconds, only what changed since the last time;
+ * tinyterm --daemon --restore reopens them (comment out to disable) */
+#define TINYTERM_SESSION_FILE       "tinyterm/session"
+#define TINYTERM_SESSION_INTERVAL   30
+
 /* One of VTE_ANTI_ALIAS_USE_DEFAULT, VTE_ANTI_ALIAS_FORCE_ENABLE, VTE_ANTI_ALIAS_FORCE_DISABLE */
 #define TINYTERM_ANTIALIAS      VTE_ANTI_ALIAS_FORCE_ENABLE
 
@@ -48,7 +82,7 @@
 /* Selection behavior for double-clicks */
 #define TINYTERM_WORD_CHARS "-A-Za-z0-9:./?%&#_=+@~"
 
-/* Custom color scheme */
+/* Custom color scheme, as "#rrggbb" (converted to palette.h by genpalette at build time) */
 #define TINYTERM_COLOR_BACKGROUND   "#1f1f1f"
 #define TINYTERM_COLOR_FOREGROUND   "#cdcdcd"
 /* black */
@@ -113,6 +147,15 @@
 #define TINYTERM_KEY_FONT_SHRINK  GDK_Down
 #define TINYTERM_KEY_FONT_RESET   GDK_equal
 #define TINYTERM_KEY_FULLSCREEN   GDK_F11
+#define TINYTERM_KEY_TAB_NEW      GDK_N   // new tab in the working directory of the current one
+#define TINYTERM_KEY_TAB_NEXT     GDK_Page_Down
+#define TINYTERM_KEY_TAB_PREVIOUS GDK_Page_Up
+#define TINYTERM_KEY_SPLIT_RIGHT  GDK_R   // split the current pane side by side
+#define TINYTERM_KEY_SPLIT_DOWN   GDK_B   // split the current pane one below the other
+#define TINYTERM_KEY_PANE_NEXT    GDK_Tab // focus the next pane of the tab
+#define TINYTERM_KEY_SEARCH       GDK_F   // search the history, Return/Shift+Return for older/newer hits
+#define TINYTERM_KEY_LOG          GDK_L   // start or stop logging the output of the current pane
+#define TINYTERM_KEY_SCHEDULE     GDK_S   // cycle the output scheduling of the current pane: auto, latency, throughput
 
 /* Regular expression matching urls */
 #define SPECIAL_CHARS   "[[:alnum:]\\Q+-_,?;.:/!%$^*&~#=()\\E]"
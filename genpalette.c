@@ -0,0 +1,111 @@
+/*
+ * MIT/X Consortium License
+ *
+ * © 2013 Jakub Klinkovský
+ * © 2009 Sebastian Linke
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Build-time generator of palette.h: converts the color strings of config.h
+ * into the GdkColor values gdk_color_parse would produce, so tinyterm does no
+ * color parsing at startup. Only "#rgb" style hex colors are supported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+
+/* parse a hex color the way pango_color_parse does, 0 on success */
+static int
+parse_color(const char* spec, unsigned* red, unsigned* green, unsigned* blue)
+{
+    unsigned* components[3] = { red, green, blue };
+    size_t len = strlen(spec);
+    size_t digits, i, j;
+    int bits;
+
+    if (spec[0] != '#' || (len - 1) % 3 != 0 || len < 4 || len > 13)
+        return -1;
+    digits = (len - 1) / 3;
+    bits = digits * 4;
+    for (i = 0; i < 3; i++) {
+        unsigned value = 0;
+        for (j = 0; j < digits; j++) {
+            char c = spec[1 + i * digits + j];
+            if (c >= '0' && c <= '9')
+                value = value * 16 + c - '0';
+            else if (c >= 'a' && c <= 'f')
+                value = value * 16 + c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                value = value * 16 + c - 'A' + 10;
+            else
+                return -1;
+        }
+        /* scale to 16 bits by repeating the digits, e.g. #ab -> 0xabab */
+        value <<= 16 - bits;
+        for (int b = bits; b < 16; b *= 2)
+            value |= value >> b;
+        *components[i] = value;
+    }
+    return 0;
+}
+
+/* print a GdkColor initializer, exits if the color can't be parsed */
+static void
+print_color(const char* name, const char* spec, const char* suffix)
+{
+    unsigned red, green, blue;
+
+    if (parse_color(spec, &red, &green, &blue) != 0) {
+        fprintf(stderr, "genpalette: %s: unsupported color \"%s\", use #rrggbb\n", name, spec);
+        exit(EXIT_FAILURE);
+    }
+    printf("{ 0, 0x%04x, 0x%04x, 0x%04x }%s", red, green, blue, suffix);
+}
+
+int
+main(void)
+{
+    const char* palette[16] = {
+        TINYTERM_COLOR0,  TINYTERM_COLOR1,  TINYTERM_COLOR2,  TINYTERM_COLOR3,
+        TINYTERM_COLOR4,  TINYTERM_COLOR5,  TINYTERM_COLOR6,  TINYTERM_COLOR7,
+        TINYTERM_COLOR8,  TINYTERM_COLOR9,  TINYTERM_COLOR10, TINYTERM_COLOR11,
+        TINYTERM_COLOR12, TINYTERM_COLOR13, TINYTERM_COLOR14, TINYTERM_COLOR15,
+    };
+    char name[32];
+    int i;
+
+    printf("/* generated from config.h by genpalette, do not edit */\n\n");
+    printf("static const GdkColor color_foreground = ");
+    print_color("TINYTERM_COLOR_FOREGROUND", TINYTERM_COLOR_FOREGROUND, ";\n");
+    printf("static const GdkColor color_background = ");
+    print_color("TINYTERM_COLOR_BACKGROUND", TINYTERM_COLOR_BACKGROUND, ";\n");
+    printf("static const GdkColor color_palette[16] = {\n");
+    for (i = 0; i < 16; i++) {
+        snprintf(name, sizeof(name), "TINYTERM_COLOR%d", i);
+        printf("    ");
+        print_color(name, palette[i], ",\n");
+    }
+    printf("};\n");
+    return EXIT_SUCCESS;
+}
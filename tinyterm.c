@@ -24,30 +24,599 @@
  *
  */
 
+#define _GNU_SOURCE     // POSIX_SPAWN_SETSID and posix_spawn_file_actions_addchdir_np
+
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <glib.h>
 #include <sys/wait.h>
 #include <gdk/gdkkeysyms.h>
 #include <vte/vte.h>
 #include <signal.h>
 #include "config.h"
+#include "palette.h"    // generated from config.h by genpalette
+
+#define PTY_READ_SIZE   (64 * 1024)     // bytes read from the pty at once
+#define PTY_OUTPUT_MAX  (1024 * 1024)   // throttled output that is fed to vte anyway
+#define PTY_FLOOD_RATE  (2 * 1024 * 1024)   // bytes per second of output from which the child floods it
+#define PTY_FLOOD_WINDOW    100         // ms over which the rate of output is measured
+#define PTY_FLOOD_BATCH (1024 * 1024)   // bytes read at once while flooding
+#define PTY_FLOOD_OUTPUT_MAX (8 * 1024 * 1024)  // output collected while flooding that is fed anyway
+#define PTY_FLOOD_FPS   10              // refresh rate of a focused terminal while flooding
+#define TYPING_TIMEOUT  500             // ms after a key press during which output is fed as it comes
+#define PTY_SYNC_TIMEOUT    150         // ms output is held at most for a synchronized update
+#define PTY_MODES_MAX   16              // parameters of a DECSET/DECRST sequence that are looked at
+#define OSC_MAX         4096            // bytes of an OSC sequence that are looked at
+#define LINKS_MAX       256             // OSC 8 hyperlinks remembered per pane
+#define LINK_WAIT_TIMEOUT   50          // ms to wait for vte to process output up to an OSC 8 sequence
+#define URL_ROWS_MAX    512             // rows with cached url matches per pane
+#define LOG_RING_SIZE   (4 * 1024 * 1024)   // child output buffered for the log writer, a power of two
+#define LOG_BATCH_SIZE  (64 * 1024)     // compressed bytes written at once
+#define LOG_INTERVAL    50              // ms without output after which the log writer flushes compressed output
+#define PREDICT_MAX     256             // typed characters predicted ahead of their echo
+#define PREDICT_MISSES_MAX  3           // wrong predictions in a row after which a line isn't predicted
+#define TMUX_KEYS_MAX   512             // input bytes sent to a tmux pane per send-keys command
+#define TMUX_WINDOW_NONE    G_MAXUINT   // tmux_window of a pane left out of the layout of its window
+#define PASTE_CHUNK_SIZE    (4 * 1024)  // pasted bytes written per main loop iteration
+#define PASTE_PROGRESS_MIN  (256 * 1024) // pastes from this size on show their progress in the title
+#define SEARCH_BLOCK_ROWS   1024        // history rows copied for the search index at once
+#define STATS_FRAMES    1024            // draw times of the most recent frames kept for --stats
+#define HEADLESS_SETTLE_TIME    100     // ms without changes after which vte has processed all output
+#define LATENCY_SAMPLES     2000        // keys timed by --latency-probe
+#define LATENCY_INTERVAL    10          // ms at least between the echo of a key and the next key
+#define LATENCY_TIMEOUT     1000        // ms after which the echo of a key counts as lost
+#define LATENCY_START_DELAY 500         // ms the echo program gets to start before the first key
+#define LAYOUT_ROWS     24              // size of the ptys of --layout panes until their vte is allocated
+#define LAYOUT_COLUMNS  80
+#define SESSION_MAGIC       "tinyterm session 1\n"
+#define SESSION_ROWS_MAX    10000           // history rows copied out of vte per main loop iteration for a snapshot
+#define SESSION_COMPACT_MIN (4 * 1024 * 1024)   // bytes of text in a session file before it may be rewritten
+#define SESSION_CHUNK_SIZE  65536           // bytes zlib converts at a time
+#define LATENCY_COMMAND     "sh -c 'stty raw -echo; exec cat'"  // default echo program of --latency-probe
+#define MEMORY_CHECK_INTERVAL   5       // s between checks of the scrollback budget and memory pressure
+#define SCROLLBACK_TRIM_MIN     1000    // history rows a trimmed terminal keeps at least
+#define SCROLLBACK_TRIM_WAIT    6       // checks after a trim before trimming again if its effect doesn't show
+#define FONT_PREWARM_SIZES  2           // zoom steps each way loaded in the background after a zoom
+#define CONFIG_STRING_MAX   256         // bytes of a string setting, including the terminating NUL
+#define CONFIG_CACHE_MAGIC  "tinyterm config cache 1"
+#define TMUX_GATEWAY_NOTE   "\r\n[tmux control mode, the windows are shown in tabs; press q to detach]\r\n"
+
+/* command-line options; in daemon mode they also describe the windows requested by clients */
+typedef struct {
+    char* command;
+    char* directory;
+    gboolean keep;
+    char* name;
+    char* title;
+    char** environment;     // environment for the child, NULL to inherit ours
+    char* startup_id;       // startup notification id of the client
+    char* log;              // file recording the output of the first pane
+    gboolean predict;       // show typed characters before the child echoes them
+} TinyTermOptions;
+
+/* keyboard shortcuts, see config.h */
+enum {
+    KEY_COPY, KEY_PASTE, KEY_OPEN, KEY_FONT_ENLARGE, KEY_FONT_SHRINK, KEY_FONT_RESET, KEY_FULLSCREEN,
+    KEY_TAB_NEW, KEY_TAB_NEXT, KEY_TAB_PREVIOUS, KEY_SPLIT_RIGHT, KEY_SPLIT_DOWN, KEY_PANE_NEXT,
+    KEY_SEARCH, KEY_LOG, KEY_SCHEDULE, KEY_COUNT
+};
+
+/* settings of config.h that can be changed in $XDG_CONFIG_HOME/tinyterm/config; plain data,
+ * as it is cached in binary form */
+typedef struct {
+    char font[CONFIG_STRING_MAX];
+    char word_chars[CONFIG_STRING_MAX];
+    glong scrollback_lines;
+    gboolean audible_bell, visible_bell;
+    guint unfocused_fps, hidden_fps;
+    GdkColor foreground, background, palette[16];
+    guint keys[KEY_COUNT];
+} TinyTermConfig;
+
+/* state of a window, shared by the panes in its tabs and splits */
+typedef struct _TinyTerm TinyTerm;
+typedef struct _SearchIndex SearchIndex;
+typedef struct _PtyLog PtyLog;
+typedef struct _TmuxClient TmuxClient;
+typedef struct _LatencyProbe LatencyProbe;
+typedef struct _SessionRestore SessionRestore;
+typedef struct {
+    GtkWidget* window;
+    GtkWidget* notebook;
+    GList* panes;           // all panes of the window, in the order they were opened
+    TinyTerm* current;      // pane that had the focus last, it sets the window title
+    gboolean keep;
+    gboolean predict;       // panes predict the echo of typed characters
+    gboolean is_fullscreen;
+    gboolean has_title;     // title set by the user, disables window_title_cb
+    char** environment;     // environment for new panes, NULL to inherit ours
+    GIOChannel* client;     // daemon client waiting for the exit status, if any
+    GtkWidget* search;      // search bar
+    TinyTerm* search_term;  // pane searched while the search bar is shown
+} TinyTermWindow;
+
+/* state of a single terminal pane */
+struct _TinyTerm {
+    TinyTermWindow* win;
+    GtkWidget* widget;      // box of the vte and its scrollbar, packed in a tab or split
+    VteTerminal* vte;
+    GPid child_pid;
+    guint child_watch;
+    char* command;          // command of the child, NULL for the user shell
+    gboolean has_focus, is_mapped, is_obscured;
+    gulong title_handler;   // window_title_cb, if connected
+    guint title_source;     // pending title update
+    guint regex_source;     // pending vte_regex_cb
+    gint64 title_time;      // time of the last title update
+
+    /* counters reported by --stats */
+    guint frames;           // frames drawn
+    guint frames_skipped;   // reads merged into a throttled feed instead of drawn on their own
+    gint64 frame_start;     // start of the frame being drawn
+    gint64 frame_time;      // total time spent drawing, in µs
+    guint32* frame_times;   // draw times of the last STATS_FRAMES frames, allocated on the first
+    gint64 feed_time;       // total time vte spent parsing output, in µs
+    guint64 bytes_read, bytes_written;
+    guint titles, bells;
+
+    /* tinyterm reads the pty itself and feeds vte at a rate depending on visibility */
+    VtePty* pty;
+    GIOChannel* pty_channel;
+    guint pty_read_watch, pty_write_watch;
+    glong pty_rows, pty_columns;
+    GByteArray* output;     // child output not yet fed to vte
+    GByteArray* input;      // input not yet written to the child
+    guint feed_source;
+    gboolean has_output;
+    guint schedule;         // SCHEDULE_*, set by KEY_SCHEDULE
+    gboolean is_flooding;   // the child wrote PTY_FLOOD_RATE or more in the last PTY_FLOOD_WINDOW
+    gint64 flood_start;     // start of the current PTY_FLOOD_WINDOW
+    gsize flood_bytes;      // output read in it
+    gint64 key_time;        // last key press, ends throughput mode for TYPING_TIMEOUT
+    PtyLog* log;            // recording of the child output, if any
+
+    /* escape sequences of the child that matter to tinyterm, parsed from its output */
+    guint scan_state;       // position in an escape sequence, see pty_scan
+    guint modes[PTY_MODES_MAX];
+    guint modes_count;
+    gboolean is_mode_request;   // DECRQM (ESC [ ? Ps $ p) rather than DECSET/DECRST
+    gboolean bracketed_paste;
+    gboolean is_synchronized;   // synchronized update (mode 2026), output is held until it ends
+    gsize sync_end;         // pending output up to the end of the last synchronized update
+    guint sync_source;      // timeout of the synchronized update
+    GString* osc;           // payload of an OSC sequence, up to OSC_MAX bytes
+    char* link_uri;         // OSC 8 hyperlink being written, if any
+    glong link_start_row, link_start_column;    // cell it starts at
+    GQueue* links;          // recent hyperlinks, the newest first
+    GArray* link_marks;     // LinkMark of the OSC 8 sequences in the pending output
+    gsize link_offset;      // pending output the tracked cursor is at, G_MAXSIZE if unknown
+    glong link_row, link_column;    // tracked cursor, where vte's will be after that output
+    guint link_wait_source; // vte is processing the output up to an OSC 8 sequence
+    gboolean is_vte_busy;   // vte was fed output it didn't report processing yet
+
+    /* url matches of rows under the pointer, rescanned only when the row text changed */
+    GHashTable* url_rows;
+    guint contents_generation;  // incremented whenever vte changes contents
+    glong hover_row, hover_column;  // cell checked for a link last, -1 to check again
+    guint hover_generation;
+    gboolean is_hovering_link;
+
+    /* paste streamed to the child in chunks */
+    GByteArray* paste;
+    guint paste_offset;
+    guint paste_keep;       // start of the closing bracket
+    gboolean is_paste_bracketed;
+    gint paste_percent;     // progress shown in the window title, -1 if none
+    char* paste_title;      // window title to restore after the paste
+
+    SearchIndex* search;    // history copied for the search bar while it is shown
+
+    gint font_size;         // size of the last zoom step, in pango units
+    guint font_source;      // pending font_resize_cb
+
+    /* predictive local echo (--predict) */
+    GString* predict;       // typed characters the child didn't echo yet, NULL if disabled
+    guint predict_shown;    // of them drawn underlined ahead of the echo
+    glong predict_column;   // cursor column the predictions drawn start at
+    gboolean is_underlined; // the child turned on underlining (SGR 4), followed for the predictions
+    guint predict_misses;   // echoes in a row that didn't match the prediction
+    gboolean is_predict_confirmed;  // the child echoed a prediction since the last Enter
+    gboolean is_alternate_screen;
 
-static int child_pid = 0;   // needs to be global for signal_handler to work
+    gint64 focus_time;      // last time the pane got the focus, 0 if never
+    glong trimmed_lines;    // scrollback lines while trimmed by memory_check_cb, 0 if not trimmed
+
+    /* tmux control mode (tmux -CC), see tmux_read */
+    TmuxClient* tmux;       // client run by the child of this pane, or the one showing this tmux pane
+    guint tmux_pane, tmux_window;   // ids of the tmux pane shown and of its window
+    guint tmux_state;       // TMUX_PANE_NONE for panes with a child of their own
+    char* tmux_cursor;      // cursor state of the tmux pane while its contents are captured
+
+    /* session snapshot of the daemon, see session_snapshot_cb */
+    guint session_id;       // group "pane<id>" of the layout and pane of the records
+    glong session_row;      // first history row not snapshotted yet
+    glong session_rows;     // history rows snapshotted since the last rewrite
+    gsize session_history;  // bytes of text in the history records of the pane
+    gsize session_screen;   // bytes of text in its last screen record
+    gboolean is_session_dirty;  // the screen changed since the last screen record
+    SessionRestore* restore;    // records of a restored pane, loaded once it is shown
+};
+
+/* an OSC 8 sequence in the pending output of a pane */
+typedef struct {
+    gsize offset;           // end of the sequence in TinyTerm.output
+    char* uri;              // hyperlink it opens, NULL if it ends the open one
+} LinkMark;
+
+/* how the output of a pane is read and fed: in large batches at PTY_FLOOD_FPS while the child
+ * floods it, as it comes otherwise, or pinned to either of them */
+enum { SCHEDULE_AUTO, SCHEDULE_LATENCY, SCHEDULE_THROUGHPUT, SCHEDULE_COUNT };
+static const char* const schedule_names[SCHEDULE_COUNT] = { "auto", "latency", "throughput" };
+
+/* states of a pane showing a tmux pane; its output is only parsed once the pane is shown */
+enum { TMUX_PANE_NONE, TMUX_PANE_NEW, TMUX_PANE_CAPTURING, TMUX_PANE_LIVE };
+
+/* replies to the commands sent to tmux that are of interest */
+enum { TMUX_REPLY_IGNORE, TMUX_REPLY_WINDOWS, TMUX_REPLY_CURSOR, TMUX_REPLY_CAPTURE };
+
+/* a pane running tmux -CC; the windows of its session are shown in tabs of the same window */
+struct _TmuxClient {
+    TinyTerm* gateway;      // pane running tmux
+    GString* line;          // line of tmux being read
+    GString* reply;         // reply to a command being read, NULL outside of %begin and %end
+    gboolean is_own_reply;  // the reply is to a command sent by tmux_command
+    GQueue* commands;       // TmuxCommand sent and not answered yet, oldest first
+    GHashTable* panes;      // TinyTerm by tmux pane id
+    GHashTable* windows;    // notebook page by tmux window id
+    glong columns, rows;    // size of the client last sent to tmux
+};
+
+static GList* terminals = NULL; // needs to be global for signal_handler to work
+static TinyTermConfig config;
 static gint initial_font_size;
-static gboolean is_fullscreen = FALSE;
+static PangoFontDescription* font = NULL;  // config.font, shared by all terminals of the process
+static GHashTable* font_sizes = NULL;       // FontSize by size in pango units
+static guint font_prewarm_source = 0;
+static gint font_prewarm_center, font_prewarm_step;
+static gboolean is_daemon = FALSE;
+static char* daemon_socket = NULL;
+static GList* pool = NULL;      // hidden, pre-spawned terminals of the daemon
+static guint pool_fill_source = 0;
+static guint pool_idle_source = 0;
+static gboolean show_timing = FALSE;
+static GIOChannel* timing_client = NULL;    // daemon client the timing of its window is sent to
+static gboolean is_daemon_timing = FALSE;   // show_timing of the daemon itself
+static gboolean show_stats = FALSE;
+static gboolean is_headless = FALSE;
+static char* dump_path = NULL;      // file written by --headless when the child exits
+static gint headless_status;        // exit status of the child, returned after the dump
+static guint headless_source = 0;
+static gint64 timing_start, timing_last;    // monotonic time of startup and of the last timing_mark
+static gboolean is_latency_probe = FALSE;
+static char* layout_path = NULL;    // --layout file
+static LatencyProbe* latency_probe = NULL;  // keystroke being timed by --latency-probe
+static gboolean is_restore = FALSE;
+static guint session_last_id = 0;   // TinyTerm.session_id of the newest pane
 
-/* spawn xdg-open and pass text as argument */
+/* stages of a keystroke timed by --latency-probe */
+enum { LATENCY_KEY, LATENCY_WRITE, LATENCY_READ, LATENCY_DRAWN, LATENCY_PRESENTED, LATENCY_STAGES };
+
+static void latency_probe_mark(guint stage);
+static void latency_probe_changed(void);
+
+/* print the time spent since the previous phase of startup (--timing) */
 static void
-xdg_open(const char* text)
+timing_mark(const char* phase)
+{
+    gint64 now;
+
+    if (!show_timing)
+        return;
+    now = g_get_monotonic_time();
+    if (timing_client) {
+        char* line = g_strdup_printf("timing: daemon: %-20s %9.3f ms  (total %9.3f ms)\n", phase,
+                                     (now - timing_last) / 1000.0, (now - timing_start) / 1000.0);
+        g_io_channel_write_chars(timing_client, line, -1, NULL, NULL);
+        g_io_channel_flush(timing_client, NULL);
+        g_free(line);
+    } else {
+        g_printerr("timing: %-28s %9.3f ms  (total %9.3f ms)\n", phase,
+                   (now - timing_last) / 1000.0, (now - timing_start) / 1000.0);
+    }
+    timing_last = now;
+}
+
+/* send the timing of a window opened by the daemon to its client (--timing), or stop with NULL */
+static void
+timing_set_client(GIOChannel* channel)
+{
+    if (timing_client)
+        g_io_channel_unref(timing_client);
+    timing_client = channel ? g_io_channel_ref(channel) : NULL;
+    show_timing = channel || is_daemon_timing;
+}
+
+/* header of the binary cache of the config file; it is used only if all fields match */
+typedef struct {
+    char magic[sizeof(CONFIG_CACHE_MAGIC)];
+    guint32 size;           // sizeof(TinyTermConfig)
+    guint32 defaults;       // hash of the compiled-in defaults the file was applied to
+    gint64 mtime;           // modification time of the config file in ns
+    gint64 file_size;
+} ConfigCacheHeader;
+
+static const char* const key_names[KEY_COUNT] = {
+    "copy", "paste", "open", "font-enlarge", "font-shrink", "font-reset", "fullscreen",
+    "tab-new", "tab-next", "tab-previous", "split-right", "split-down", "pane-next",
+    "search", "log", "schedule"
+};
+
+static void
+config_defaults(TinyTermConfig* defaults)
+{
+    const guint keys[KEY_COUNT] = {
+        TINYTERM_KEY_COPY, TINYTERM_KEY_PASTE, TINYTERM_KEY_OPEN, TINYTERM_KEY_FONT_ENLARGE,
+        TINYTERM_KEY_FONT_SHRINK, TINYTERM_KEY_FONT_RESET, TINYTERM_KEY_FULLSCREEN,
+        TINYTERM_KEY_TAB_NEW, TINYTERM_KEY_TAB_NEXT, TINYTERM_KEY_TAB_PREVIOUS,
+        TINYTERM_KEY_SPLIT_RIGHT, TINYTERM_KEY_SPLIT_DOWN, TINYTERM_KEY_PANE_NEXT,
+        TINYTERM_KEY_SEARCH, TINYTERM_KEY_LOG, TINYTERM_KEY_SCHEDULE
+    };
+
+    memset(defaults, 0, sizeof(*defaults));     // padding is hashed by config_hash
+    g_strlcpy(defaults->font, TINYTERM_FONT, CONFIG_STRING_MAX);
+    g_strlcpy(defaults->word_chars, TINYTERM_WORD_CHARS, CONFIG_STRING_MAX);
+    defaults->scrollback_lines = TINYTERM_SCROLLBACK_LINES;
+    defaults->audible_bell = TINYTERM_AUDIBLE_BELL;
+    defaults->visible_bell = TINYTERM_VISIBLE_BELL;
+    defaults->unfocused_fps = TINYTERM_UNFOCUSED_FPS;
+    defaults->hidden_fps = TINYTERM_HIDDEN_FPS;
+    defaults->foreground = color_foreground;
+    defaults->background = color_background;
+    memcpy(defaults->palette, color_palette, sizeof(color_palette));
+    memcpy(defaults->keys, keys, sizeof(keys));
+}
+
+/* FNV-1a hash of the settings, so a cache written by a build with other defaults is ignored */
+static guint32
+config_hash(const TinyTermConfig* settings)
+{
+    const guchar* p = (const guchar*) settings;
+    guint32 hash = 2166136261u;
+    gsize i;
+
+    for (i = 0; i < sizeof(*settings); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+static void
+config_get_string(GKeyFile* file, const char* group, const char* key, char* value)
+{
+    char* string = g_key_file_get_string(file, group, key, NULL);
+
+    if (string) {
+        if (g_strlcpy(value, string, CONFIG_STRING_MAX) >= CONFIG_STRING_MAX)
+            g_printerr("config: %s/%s is too long, truncated\n", group, key);
+        g_free(string);
+    }
+}
+
+static void
+config_get_integer(GKeyFile* file, const char* group, const char* key, gint minimum, gint* value)
 {
     GError* error = NULL;
-    char* command = g_strconcat("xdg-open ", text, NULL);
-    g_spawn_command_line_async(command, &error);
-    if (error) {
-        g_printerr("xdg-open: %s\n", error->message);
+    gint integer = g_key_file_get_integer(file, group, key, &error);
+
+    if (!error && integer >= minimum)
+        *value = integer;
+    else if (!error || error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND)
+        g_printerr("config: %s/%s is not a number of at least %d\n", group, key, minimum);
+    if (error)
+        g_error_free(error);
+}
+
+static void
+config_get_boolean(GKeyFile* file, const char* group, const char* key, gboolean* value)
+{
+    GError* error = NULL;
+    gboolean boolean = g_key_file_get_boolean(file, group, key, &error);
+
+    if (!error)
+        *value = boolean;
+    else if (error->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND)
+        g_printerr("config: %s/%s is not true or false\n", group, key);
+    if (error)
+        g_error_free(error);
+}
+
+static void
+config_get_color(GKeyFile* file, const char* group, const char* key, GdkColor* value)
+{
+    char* string = g_key_file_get_string(file, group, key, NULL);
+
+    if (string && !gdk_color_parse(string, value))
+        g_printerr("config: %s/%s is not a color\n", group, key);
+    g_free(string);
+}
+
+/* apply the settings of a config file on top of the compiled-in ones, FALSE if it can't be read */
+static gboolean
+config_parse(TinyTermConfig* settings, const char* path)
+{
+    GKeyFile* file = g_key_file_new();
+    GError* error = NULL;
+    gint integer;
+    guint i;
+
+    if (!g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, &error)) {
+        g_printerr("Failed to read %s: %s\n", path, error->message);
         g_error_free(error);
+        g_key_file_free(file);
+        return FALSE;
+    }
+
+    config_get_string(file, "terminal", "font", settings->font);
+    config_get_string(file, "terminal", "word-chars", settings->word_chars);
+    integer = settings->scrollback_lines;
+    config_get_integer(file, "terminal", "scrollback-lines", -1, &integer);
+    settings->scrollback_lines = integer;
+    config_get_boolean(file, "terminal", "audible-bell", &settings->audible_bell);
+    config_get_boolean(file, "terminal", "visible-bell", &settings->visible_bell);
+    integer = settings->unfocused_fps;
+    config_get_integer(file, "terminal", "unfocused-fps", 1, &integer);
+    settings->unfocused_fps = integer;
+    integer = settings->hidden_fps;
+    config_get_integer(file, "terminal", "hidden-fps", 1, &integer);
+    settings->hidden_fps = integer;
+
+    config_get_color(file, "colors", "foreground", &settings->foreground);
+    config_get_color(file, "colors", "background", &settings->background);
+    for (i = 0; i < G_N_ELEMENTS (settings->palette); i++) {
+        char key[8];
+        g_snprintf(key, sizeof(key), "color%u", i);
+        config_get_color(file, "colors", key, &settings->palette[i]);
+    }
+
+    /* keys are given by their names in gdkkeysyms.h without GDK_, letters regardless of case */
+    for (i = 0; i < KEY_COUNT; i++) {
+        char* name = g_key_file_get_string(file, "keys", key_names[i], NULL);
+        if (name) {
+            guint keyval = gdk_keyval_from_name(name);
+            if (keyval == GDK_VoidSymbol || keyval == 0)
+                g_printerr("config: keys/%s is not a key name\n", key_names[i]);
+            else
+                settings->keys[i] = gdk_keyval_to_upper(keyval);
+            g_free(name);
+        }
+    }
+    g_key_file_free(file);
+    return TRUE;
+}
+
+/* load the settings: the defaults of config.h, overridden by the config file if there is one;
+ * the parsed file is cached in binary form and reused while the file is unchanged */
+static void
+config_load(void)
+{
+    char* path = g_build_filename(g_get_user_config_dir(), "tinyterm", "config", NULL);
+    char* cache_path;
+    ConfigCacheHeader header;
+    GMappedFile* cache;
+    struct stat st;
+
+    config_defaults(&config);
+    if (stat(path, &st) < 0) {
+        g_free(path);
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CONFIG_CACHE_MAGIC, sizeof(header.magic));
+    header.size = sizeof(TinyTermConfig);
+    header.defaults = config_hash(&config);
+    header.mtime = (gint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    header.file_size = st.st_size;
+
+    cache_path = g_build_filename(g_get_user_cache_dir(), "tinyterm", "config.cache", NULL);
+    cache = g_mapped_file_new(cache_path, FALSE, NULL);
+    if (cache && g_mapped_file_get_length(cache) == sizeof(header) + sizeof(config)
+            && memcmp(g_mapped_file_get_contents(cache), &header, sizeof(header)) == 0) {
+        memcpy(&config, g_mapped_file_get_contents(cache) + sizeof(header), sizeof(config));
+        timing_mark("config_load: cache");
+    } else if (config_parse(&config, path)) {
+        /* written to a temporary file first, so concurrent launches never see half a cache */
+        char* dir = g_path_get_dirname(cache_path);
+        GString* contents = g_string_new_len((const char*) &header, sizeof(header));
+        g_string_append_len(contents, (const char*) &config, sizeof(config));
+        if (g_mkdir_with_parents(dir, 0700) == 0)
+            g_file_set_contents(cache_path, contents->str, contents->len, NULL);
+        g_string_free(contents, TRUE);
+        g_free(dir);
+        timing_mark("config_load: parse");
+    }
+    if (cache)
+        g_mapped_file_unref(cache);
+    g_free(cache_path);
+    g_free(path);
+}
+
+/* callback to report the first occurrence of an event (--timing) */
+static gboolean
+timing_event_cb(GtkWidget* widget, GdkEvent* event, const char* phase)
+{
+    timing_mark(phase);
+    g_signal_handlers_disconnect_matched(widget, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, (gpointer) phase);
+    if (timing_client && strcmp(phase, "first frame drawn") == 0)
+        timing_set_client(NULL);
+    return FALSE;
+}
+
+
+/* start a program with posix_spawn, which unlike fork doesn't copy the address space of a
+ * large daemon, passing on only stdio; a tty becomes stdio and the controlling terminal of
+ * a new session. Returns 0 or an errno value. */
+static int
+spawn_async(char** argv, char** environment, const char* directory, const char* tty, GPid* pid)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t signals;
+    int error;
+
+    posix_spawn_file_actions_init(&actions);
+    if (tty) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, tty, O_RDWR, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDERR_FILENO);
     }
-    g_free(command);
+    if (directory)
+        posix_spawn_file_actions_addchdir_np(&actions, directory);
+    #if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+    #endif
+
+    /* exec resets our handlers, but not the SIGPIPE the daemon ignores */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | (tty ? POSIX_SPAWN_SETSID : 0));
+
+    error = posix_spawnp(pid, argv[0], &actions, &attr, argv, environment ? environment : environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return error;
+}
+
+/* callback to reap children of terminals that were closed before them */
+static void
+child_reap_cb(GPid pid, gint status, gpointer data)
+{
+    g_spawn_close_pid(pid);
+}
+
+/* spawn xdg-open and pass text as argument */
+static void
+xdg_open(const char* text)
+{
+    char* argv[] = { "xdg-open", (char*) text, NULL };
+    GPid pid;
+    int error = spawn_async(argv, NULL, NULL, NULL, &pid);
+
+    if (error)
+        g_printerr("xdg-open: %s\n", g_strerror(error));
+    else
+        g_child_watch_add(pid, child_reap_cb, NULL);
 }
 
 /* callback to receive data from GtkClipboard */
@@ -67,6 +636,121 @@ xdg_open_selection(GtkWidget* terminal)
     gtk_clipboard_request_text(clipboard, xdg_open_selection_cb, NULL);
 }
 
+/* a copy to the clipboard, converted from the primary selection of vte as long as vte
+ * holds it; the text is only pinned once vte is about to give it up */
+typedef struct {
+    VteTerminal* vte;
+    char* text;             // pinned text, NULL while vte holds the selection
+    gulong selection_handler, owner_handler;
+} ClipboardCopy;
+
+static GtkClipboard*
+clipboard_primary(ClipboardCopy* copy)
+{
+    return gtk_widget_get_clipboard(GTK_WIDGET (copy->vte), GDK_SELECTION_PRIMARY);
+}
+
+/* stop following the primary selection of vte */
+static void
+clipboard_release(ClipboardCopy* copy)
+{
+    if (copy->selection_handler)
+        g_signal_handler_disconnect(copy->vte, copy->selection_handler);
+    if (copy->owner_handler)
+        g_signal_handler_disconnect(clipboard_primary(copy), copy->owner_handler);
+    copy->selection_handler = copy->owner_handler = 0;
+}
+
+/* pin the text before vte drops or replaces it; vte owns the primary selection, so
+ * this is answered without a round trip to X */
+static void
+clipboard_pin(ClipboardCopy* copy)
+{
+    GtkClipboard* primary = clipboard_primary(copy);
+
+    clipboard_release(copy);
+    if (gtk_clipboard_get_owner(primary) == G_OBJECT (copy->vte)) {
+        copy->text = gtk_clipboard_wait_for_text(primary);
+        return;
+    }
+    /* too late, vte lost the selection; it still knows the selected cells, so let it copy
+     * them itself, which ends this copy */
+    vte_terminal_copy_clipboard(copy->vte);
+}
+
+/* callback for vte starting a selection, it replaces the one copied */
+static void
+clipboard_selection_cb(VteTerminal* vte, ClipboardCopy* copy)
+{
+    clipboard_pin(copy);
+}
+
+/* callback for another client taking the primary selection */
+static void
+clipboard_owner_cb(GtkClipboard* clipboard, GdkEventOwnerChange* event, ClipboardCopy* copy)
+{
+    if (gtk_clipboard_get_owner(clipboard) != G_OBJECT (copy->vte))
+        clipboard_pin(copy);
+}
+
+/* callback to hand copied text to a requestor; GTK sends large text with INCR transfers */
+static void
+clipboard_get_cb(GtkClipboard* clipboard, GtkSelectionData* data, guint info, ClipboardCopy* copy)
+{
+    char* text;
+
+    if (copy->text) {
+        gtk_selection_data_set_text(data, copy->text, -1);
+    } else if ((text = gtk_clipboard_wait_for_text(clipboard_primary(copy)))) {
+        gtk_selection_data_set_text(data, text, -1);
+        g_free(text);
+    }
+}
+
+/* callback to free a copy once another client owns the clipboard */
+static void
+clipboard_clear_cb(GtkClipboard* clipboard, ClipboardCopy* copy)
+{
+    clipboard_release(copy);
+    g_object_unref(copy->vte);
+    g_free(copy->text);
+    g_free(copy);
+}
+
+/* copy the selection to the clipboard; vte_terminal_copy_clipboard would walk all selected
+ * rows again, the text vte holds for the primary selection is converted once it is pasted */
+static void
+clipboard_copy(VteTerminal* vte)
+{
+    static GtkTargetEntry* targets = NULL;
+    static gint n_targets;
+    GtkClipboard* primary = gtk_widget_get_clipboard(GTK_WIDGET (vte), GDK_SELECTION_PRIMARY);
+    ClipboardCopy* copy;
+
+    if (!vte_terminal_get_has_selection(vte) || gtk_clipboard_get_owner(primary) != G_OBJECT (vte)) {
+        vte_terminal_copy_clipboard(vte);
+        return;
+    }
+    if (!targets) {
+        GtkTargetList* list = gtk_target_list_new(NULL, 0);
+        gtk_target_list_add_text_targets(list, 0);
+        targets = gtk_target_table_new_from_list(list, &n_targets);
+        gtk_target_list_unref(list);
+    }
+
+    copy = g_new0(ClipboardCopy, 1);
+    copy->vte = g_object_ref(vte);
+    if (!gtk_clipboard_set_with_data(gtk_widget_get_clipboard(GTK_WIDGET (vte), GDK_SELECTION_CLIPBOARD), targets,
+                                     n_targets, (GtkClipboardGetFunc) clipboard_get_cb,
+                                     (GtkClipboardClearFunc) clipboard_clear_cb, copy)) {
+        g_object_unref(vte);
+        g_free(copy);
+        return;
+    }
+    copy->selection_handler = g_signal_connect(vte, "selection-changed", G_CALLBACK (clipboard_selection_cb), copy);
+    copy->owner_handler = g_signal_connect(primary, "owner-change", G_CALLBACK (clipboard_owner_cb), copy);
+}
+
 /* callback to set window urgency hint on beep events */
 static void
 window_urgency_hint_cb(VteTerminal* vte)
@@ -82,11 +766,49 @@ window_focus_cb(GtkWindow* window)
     return FALSE;
 }
 
-/* callback to dynamically change window title */
+/* the notebook page holding a pane, either its own widget or a split containing it */
+static GtkWidget*
+terminal_page(TinyTerm* term)
+{
+    GtkWidget* page = term->widget;
+
+    while (gtk_widget_get_parent(page) != term->win->notebook)
+        page = gtk_widget_get_parent(page);
+    return page;
+}
+
+/* set the window and tab title from the current pane, unless it is unchanged */
+static gboolean
+window_title_update(TinyTerm* term)
+{
+    const char* title = vte_terminal_get_window_title(term->vte);
+    GtkWindow* window = GTK_WINDOW (term->win->window);
+    GtkLabel* label;
+
+    term->title_source = 0;
+    term->title_time = g_get_monotonic_time();
+    if (!title || term != term->win->current || term->paste_title)
+        return FALSE;
+    if (g_strcmp0(title, gtk_window_get_title(window)) != 0)
+        gtk_window_set_title(window, title);
+    label = GTK_LABEL (gtk_notebook_get_tab_label(GTK_NOTEBOOK (term->win->notebook), terminal_page(term)));
+    if (g_strcmp0(title, gtk_label_get_text(label)) != 0)
+        gtk_label_set_text(label, title);
+    return FALSE;
+}
+
+/* callback to dynamically change window title, at most once per TINYTERM_TITLE_INTERVAL */
 static void
-window_title_cb(VteTerminal* vte)
+window_title_cb(VteTerminal* vte, TinyTerm* term)
 {
-    gtk_window_set_title(GTK_WINDOW (gtk_widget_get_toplevel(GTK_WIDGET (vte))), vte_terminal_get_window_title(vte));
+    gint64 elapsed = (g_get_monotonic_time() - term->title_time) / 1000;
+
+    if (term->title_source)
+        return;
+    if (elapsed >= TINYTERM_TITLE_INTERVAL)
+        window_title_update(term);
+    else
+        term->title_source = g_timeout_add(TINYTERM_TITLE_INTERVAL - elapsed, (GSourceFunc) window_title_update, term);
 }
 
 /* apply geometry hints to handle terminal resizing */
@@ -109,178 +831,4752 @@ set_geometry_hints(VteTerminal* vte)
                                   GDK_HINT_RESIZE_INC | GDK_HINT_MIN_SIZE | GDK_HINT_BASE_SIZE);
 }
 
-/* enlarge/shrink the font */
+/* a zoom step of the font, loaded once per process and kept for later zooms */
+typedef struct {
+    PangoFontDescription* desc;
+    PangoFont* font;        // keeps the font and its glyph cache of this size loaded
+} FontSize;
+
+static FontSize*
+font_size_get(gint size)
+{
+    static PangoContext* context = NULL;
+    FontSize* entry;
+
+    if (!font_sizes)
+        font_sizes = g_hash_table_new(NULL, NULL);
+    if (!context)
+        context = gdk_pango_context_get();
+    entry = g_hash_table_lookup(font_sizes, GINT_TO_POINTER (size));
+    if (!entry) {
+        entry = g_new(FontSize, 1);
+        entry->desc = pango_font_description_copy(font);
+        pango_font_description_set_size(entry->desc, size);
+        entry->font = pango_context_load_font(context, entry->desc);
+        g_hash_table_insert(font_sizes, GINT_TO_POINTER (size), entry);
+    }
+    return entry;
+}
+
+/* callback to load the sizes around the last zoom step, one per main loop iteration */
+static gboolean
+font_prewarm_cb(gpointer data)
+{
+    gint step = font_prewarm_step++;
+    gint size = font_prewarm_center + (step / 2 + 1) * (step % 2 ? -1 : 1) * PANGO_SCALE;
+
+    if (step >= 2 * FONT_PREWARM_SIZES) {
+        font_prewarm_source = 0;
+        return FALSE;
+    }
+    if (size >= PANGO_SCALE)
+        font_size_get(size);
+    return TRUE;
+}
+
+/* callback to apply the size of the last zoom step to a terminal */
+static gboolean
+font_resize_cb(TinyTerm* term)
+{
+    FontSize* entry = font_size_get(term->font_size);
+
+    term->font_source = 0;
+    vte_terminal_set_font_full(term->vte, entry->desc, TINYTERM_ANTIALIAS);
+    set_geometry_hints(term->vte);
+
+    /* the next zoom steps are likely the neighbouring sizes */
+    font_prewarm_center = term->font_size;
+    font_prewarm_step = 0;
+    if (!font_prewarm_source)
+        font_prewarm_source = g_idle_add_full(G_PRIORITY_LOW, font_prewarm_cb, NULL, NULL);
+    return FALSE;
+}
+
+/* enlarge/shrink the font; key repeat can zoom faster than fonts load, so only the last
+ * step is applied, before the next frame is drawn */
 static void
-resize_font(VteTerminal* vte, gint size, gboolean is_absolute)
+resize_font(TinyTerm* term, gint size, gboolean is_absolute)
 {
-    PangoFontDescription *desc = pango_font_description_copy(vte_terminal_get_font(vte));
     if (!is_absolute)
-        size = pango_font_description_get_size(desc) + size * PANGO_SCALE;
-    pango_font_description_set_size(desc, size);
-    vte_terminal_set_font(vte, desc);
-    set_geometry_hints(vte);
-    pango_font_description_free(desc);
+        size = term->font_size + size * PANGO_SCALE;
+    size = MAX(size, PANGO_SCALE);
+    if (size == term->font_size)
+        return;
+    term->font_size = size;
+    if (!term->font_source)
+        term->font_source = g_idle_add_full(G_PRIORITY_HIGH_IDLE, (GSourceFunc) font_resize_cb, term, NULL);
 }
 
 /* toggle fullscreen state */
 static void
-toggle_fullscreen(VteTerminal* vte)
+toggle_fullscreen(TinyTermWindow* win)
 {
-    if (is_fullscreen) {
-        is_fullscreen = FALSE;
-        gtk_window_unfullscreen(GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(vte))));
+    if (win->is_fullscreen) {
+        win->is_fullscreen = FALSE;
+        gtk_window_unfullscreen(GTK_WINDOW(win->window));
     } else {
-        is_fullscreen = TRUE;
-        gtk_window_fullscreen(GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(vte))));
+        win->is_fullscreen = TRUE;
+        gtk_window_fullscreen(GTK_WINDOW(win->window));
     }
 }
 
+static void terminal_tab_new(TinyTerm* term);
+static void terminal_split(TinyTerm* term, gboolean is_vertical);
+static void terminal_focus_next(TinyTerm* term);
+static void terminal_paste(TinyTerm* term);
+static void search_open(TinyTerm* term);
+static void terminal_log_toggle(TinyTerm* term);
+static void terminal_feed(TinyTerm* term);
+
 /* callback to react to key press events */
 static gboolean
-key_press_cb(VteTerminal* vte, GdkEventKey* event)
+key_press_cb(VteTerminal* vte, GdkEventKey* event, TinyTerm* term)
 {
+    guint keyval = gdk_keyval_to_upper(event->keyval);
+    guint key;
+
+    /* typing switches a flooded pane back to drawing output as it comes, Ctrl+C included */
+    term->key_time = g_get_monotonic_time();
+    if (term->feed_source && term->schedule != SCHEDULE_THROUGHPUT && term->has_focus)
+        terminal_feed(term);
+
     if ((event->state & (TINYTERM_MODIFIER)) == (TINYTERM_MODIFIER)) {
-        switch (gdk_keyval_to_upper(event->keyval)) {
-            case TINYTERM_KEY_COPY:
-                vte_terminal_copy_clipboard(vte);
+        for (key = 0; key < KEY_COUNT; key++)
+            if (config.keys[key] == keyval)
+                break;
+        switch (key) {
+            case KEY_COPY:
+                clipboard_copy(vte);
                 return TRUE;
-            case TINYTERM_KEY_PASTE:
-                vte_terminal_paste_clipboard(vte);
+            case KEY_PASTE:
+                terminal_paste(term);
                 return TRUE;
-            case TINYTERM_KEY_OPEN:
+            case KEY_OPEN:
                 xdg_open_selection(vte);
                 return TRUE;
-            case TINYTERM_KEY_FONT_ENLARGE:
-                resize_font(vte, +1, FALSE);
+            case KEY_FONT_ENLARGE:
+                resize_font(term, +1, FALSE);
+                return TRUE;
+            case KEY_FONT_SHRINK:
+                resize_font(term, -1, FALSE);
+                return TRUE;
+            case KEY_FONT_RESET:
+                resize_font(term, initial_font_size, TRUE);
+                return TRUE;
+            case KEY_TAB_NEW:
+                terminal_tab_new(term);
+                return TRUE;
+            case KEY_TAB_NEXT:
+                gtk_notebook_next_page(GTK_NOTEBOOK (term->win->notebook));
+                return TRUE;
+            case KEY_TAB_PREVIOUS:
+                gtk_notebook_prev_page(GTK_NOTEBOOK (term->win->notebook));
+                return TRUE;
+            case KEY_SPLIT_RIGHT:
+                terminal_split(term, FALSE);
+                return TRUE;
+            case KEY_SPLIT_DOWN:
+                terminal_split(term, TRUE);
                 return TRUE;
-            case TINYTERM_KEY_FONT_SHRINK:
-                resize_font(vte, -1, FALSE);
+            case KEY_PANE_NEXT:
+                terminal_focus_next(term);
                 return TRUE;
-            case TINYTERM_KEY_FONT_RESET:
-                resize_font(vte, initial_font_size, TRUE);
+            case KEY_SEARCH:
+                search_open(term);
+                return TRUE;
+            case KEY_LOG:
+                terminal_log_toggle(term);
+                return TRUE;
+            case KEY_SCHEDULE:
+                term->schedule = (term->schedule + 1) % SCHEDULE_COUNT;
                 return TRUE;
         }
-    } else if (event->keyval == TINYTERM_KEY_FULLSCREEN) {
-        toggle_fullscreen(vte);
+    } else if (event->keyval == config.keys[KEY_FULLSCREEN]) {
+        toggle_fullscreen(term->win);
         return TRUE;
     }
     return FALSE;
 }
 
+/* url regex shared by all terminals of the process, compiled on first use */
+static GRegex*
+get_url_regex(void)
+{
+    static GRegex* regex = NULL;
+
+    if (!regex) {
+        regex = g_regex_new(url_regex, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, G_REGEX_MATCH_NOTEMPTY, NULL);
+        timing_mark("url regex compile");
+    }
+    return regex;
+}
+
+/* callback to set up the url regex once startup is done, off the critical path */
+static gboolean
+vte_regex_cb(TinyTerm* term)
+{
+    term->regex_source = 0;
+    vte_terminal_search_set_gregex(term->vte, get_url_regex());
+    return FALSE;
+}
+
+/* callback to schedule vte_regex_cb once the pane is drawn first */
+static gboolean
+vte_regex_expose_cb(GtkWidget* widget, GdkEventExpose* event, TinyTerm* term)
+{
+    g_signal_handlers_disconnect_by_func(widget, vte_regex_expose_cb, term);
+    term->regex_source = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc) vte_regex_cb, term, NULL);
+    return FALSE;
+}
+
 static void
 vte_config(VteTerminal* vte)
 {
-    GdkColor color_fg, color_bg;
-    GdkColor color_palette[16];
-    GRegex* regex = g_regex_new(url_regex, G_REGEX_CASELESS, G_REGEX_MATCH_NOTEMPTY, NULL);
+    /* the font is shared by all terminals of the process, colors come from palette.h or the config file */
     const PangoFontDescription* desc;
 
-    vte_terminal_search_set_gregex(vte, regex);
+    if (!font) {
+        font = pango_font_description_from_string(config.font);
+        timing_mark("vte_config: font parse");
+    }
+
     vte_terminal_search_set_wrap_around     (vte, TINYTERM_SEARCH_WRAP_AROUND);
-    vte_terminal_set_audible_bell           (vte, TINYTERM_AUDIBLE_BELL);
-    vte_terminal_set_visible_bell           (vte, TINYTERM_VISIBLE_BELL);
+    vte_terminal_set_audible_bell           (vte, config.audible_bell);
+    vte_terminal_set_visible_bell           (vte, config.visible_bell);
     vte_terminal_set_cursor_shape           (vte, TINYTERM_CURSOR_SHAPE);
     vte_terminal_set_cursor_blink_mode      (vte, TINYTERM_CURSOR_BLINK);
-    vte_terminal_set_word_chars             (vte, TINYTERM_WORD_CHARS);
-    vte_terminal_set_scrollback_lines       (vte, TINYTERM_SCROLLBACK_LINES);
-    vte_terminal_set_font_from_string_full  (vte, TINYTERM_FONT, TINYTERM_ANTIALIAS);
+    vte_terminal_set_word_chars             (vte, config.word_chars);
+    vte_terminal_set_scrollback_lines       (vte, config.scrollback_lines < 0 ? G_MAXLONG : config.scrollback_lines);
+    timing_mark("vte_config: settings");
+    vte_terminal_set_font_full              (vte, font, TINYTERM_ANTIALIAS);
+    timing_mark("vte_config: font set");
 
     desc = vte_terminal_get_font(vte);
     initial_font_size = pango_font_description_get_size(desc);
 
-    /* init colors */
-    gdk_color_parse(TINYTERM_COLOR_FOREGROUND, &color_fg);
-    gdk_color_parse(TINYTERM_COLOR_BACKGROUND, &color_bg);
-    gdk_color_parse(TINYTERM_COLOR0,  &color_palette[0]);
-    gdk_color_parse(TINYTERM_COLOR1,  &color_palette[1]);
-    gdk_color_parse(TINYTERM_COLOR2,  &color_palette[2]);
-    gdk_color_parse(TINYTERM_COLOR3,  &color_palette[3]);
-    gdk_color_parse(TINYTERM_COLOR4,  &color_palette[4]);
-    gdk_color_parse(TINYTERM_COLOR5,  &color_palette[5]);
-    gdk_color_parse(TINYTERM_COLOR6,  &color_palette[6]);
-    gdk_color_parse(TINYTERM_COLOR7,  &color_palette[7]);
-    gdk_color_parse(TINYTERM_COLOR8,  &color_palette[8]);
-    gdk_color_parse(TINYTERM_COLOR9,  &color_palette[9]);
-    gdk_color_parse(TINYTERM_COLOR10, &color_palette[10]);
-    gdk_color_parse(TINYTERM_COLOR11, &color_palette[11]);
-    gdk_color_parse(TINYTERM_COLOR12, &color_palette[12]);
-    gdk_color_parse(TINYTERM_COLOR13, &color_palette[13]);
-    gdk_color_parse(TINYTERM_COLOR14, &color_palette[14]);
-    gdk_color_parse(TINYTERM_COLOR15, &color_palette[15]);
+    vte_terminal_set_colors(vte, &config.foreground, &config.background, config.palette, 16);
+    timing_mark("vte_config: colors set");
+}
+
+/* whether a typed character can be drawn ahead of its echo: outside of full-screen
+ * applications, with nothing but blanks right of the cursor, so undoing it is safe */
+static gboolean
+predict_is_safe(TinyTerm* term)
+{
+    glong columns = vte_terminal_get_column_count(term->vte);
+    glong column, row;
+    gboolean is_safe;
+    char* rest;
 
-    vte_terminal_set_colors(vte, &color_fg, &color_bg, &color_palette, 16);
+    if (term->is_alternate_screen || term->paste)
+        return FALSE;
+    vte_terminal_get_cursor_position(term->vte, &column, &row);
+    if (column + 1 >= columns)
+        return FALSE;   // the prediction would wrap
+    rest = vte_terminal_get_text_range(term->vte, row, column, row, columns - 1, NULL, NULL, NULL);
+    is_safe = rest && rest[strspn(rest, " \n")] == '\0';
+    g_free(rest);
+    return is_safe;
 }
 
+/* erase the predictions drawn, before vte is fed the output of the child; they never wrap,
+ * so going back to their column is enough. The save slot of DECSC belongs to the child */
 static void
-vte_spawn(VteTerminal* vte, char* working_directory, char* command, char** environment)
+predict_undo(TinyTerm* term)
 {
-    GError* error = NULL;
-    char** command_argv = NULL;
+    char undo[32];
+    gint len;
 
-    /* Parse command into array */
-    if (!command)
-        command = vte_get_user_shell();
-    g_shell_parse_argv(command, NULL, &command_argv, &error);
-    if (error) {
-        g_printerr("Failed to parse command: %s\n", error->message);
-        g_error_free(error);
-        exit(EXIT_FAILURE);
-    }
+    if (term->predict_shown == 0)
+        return;
+    len = g_snprintf(undo, sizeof(undo), "\033[%ldG\033[K", term->predict_column + 1);
+    vte_terminal_feed(term->vte, undo, len);
+    term->predict_shown = 0;
+}
 
-    /* Create pty object */
-    VtePty* pty = vte_terminal_pty_new(vte, VTE_PTY_NO_HELPER, &error);
-    if (error) {
-        g_printerr("Failed to create pty: %s\n", error->message);
-        g_error_free(error);
-        exit(EXIT_FAILURE);
-    }
-    vte_pty_set_term(pty, TINYTERM_TERMINFO);
-    vte_terminal_set_pty_object(vte, pty);
+/* draw the predictions not drawn yet, underlined; only once the child echoed one on this line,
+ * so e.g. passwords are never shown */
+static void
+predict_show(TinyTerm* term)
+{
+    GString* show;
 
-    /* Spawn default shell (or specified command) */
-    g_spawn_async(working_directory, command_argv, environment,
-                  (G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH | G_SPAWN_LEAVE_DESCRIPTORS_OPEN),  // flags from GSpawnFlags
-                  (GSpawnChildSetupFunc)vte_pty_child_setup, // an extra child setup function to run in the child just before exec()
-                  pty,          // user data for child_setup
-                  &child_pid,   // a location to store the child PID
-                  &error);      // return location for a GError
-    if (error) {
-        g_printerr("%s\n", error->message);
-        g_error_free(error);
-        exit(EXIT_FAILURE);
-    }
-    vte_terminal_watch_child(vte, child_pid);
-    g_strfreev(command_argv);
+    if (!term->is_predict_confirmed || term->predict->len <= term->predict_shown || !predict_is_safe(term))
+        return;
+    if (term->predict_shown == 0)
+        vte_terminal_get_cursor_position(term->vte, &term->predict_column, NULL);
+    /* the child gets its attributes back right after */
+    show = g_string_new(term->is_underlined ? NULL : "\033[4m");
+    g_string_append(show, term->predict->str + term->predict_shown);
+    if (!term->is_underlined)
+        g_string_append(show, "\033[24m");
+    vte_terminal_feed(term->vte, show->str, show->len);
+    g_string_free(show, TRUE);
+    term->predict_shown = term->predict->len;
 }
 
-/* callback to exit TinyTerm with exit status of child process */
+/* follow whether the child turned underlining on in the output vte is fed, so predictions
+ * restore it; an SGR sequence split across two feeds is missed */
 static void
-vte_exit_cb(VteTerminal* vte)
+predict_track_sgr(TinyTerm* term, const char* data, gsize len)
 {
-    int status = vte_terminal_get_child_exit_status(vte);
-    gtk_main_quit();
-    exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+    const char* end = data + len;
+    const char* p;
+    guint params[PTY_MODES_MAX];
+    guint count, i;
+
+    while ((p = memchr(data, '\033', end - data)) && p + 1 < end) {
+        data = p + 1;
+        if (*data != '[')
+            continue;
+        for (p = ++data; p < end && (g_ascii_isdigit(*p) || *p == ';' || *p == ':'); p++)
+            ;
+        if (p == end || *p != 'm')
+            continue;
+        /* an empty parameter resets like 0; of subparameters only 4:0 matters, it ends underlining */
+        for (count = 0; data <= p && count < PTY_MODES_MAX; count++, data++) {
+            params[count] = 0;
+            for (; data < p && g_ascii_isdigit(*data); data++)
+                params[count] = MIN(params[count] * 10 + (*data - '0'), G_MAXUINT16);
+            if (data < p && *data == ':' && params[count] == 4 && data + 1 < p && data[1] == '0')
+                params[count] = 24;
+            while (data < p && *data != ';')
+                data++;
+        }
+        for (i = 0; i < count; i++) {
+            if (params[i] == 0 || params[i] == 24)
+                term->is_underlined = FALSE;
+            else if (params[i] == 4)
+                term->is_underlined = TRUE;
+            else if ((params[i] == 38 || params[i] == 48 || params[i] == 58) && i + 1 < count)
+                i += params[i + 1] == 5 ? 2 : params[i + 1] == 2 ? 4 : 0;   // colors, not attributes
+        }
+        data = p + 1;
+    }
 }
 
+/* compare child output with the pending predictions, the ones echoed are done */
 static void
-parse_arguments(int argc, char* argv[], char** command, char** directory, gboolean* keep, char** name, char** title)
+predict_reconcile(TinyTerm* term, const char* data, gsize len)
 {
-    gboolean version = FALSE;   // show version?
-    const GOptionEntry entries[] = {
-        {"version",   'v', 0, G_OPTION_ARG_NONE,    &version,   "Display program version and exit.", 0},
-        {"execute",   'e', 0, G_OPTION_ARG_STRING,  command,    "Execute command instead of default shell.", "COMMAND"},
-        {"directory", 'd', 0, G_OPTION_ARG_STRING,  directory,  "Sets the working directory for the shell (or the command specified via -e).", "PATH"},
-        {"keep",      'k', 0, G_OPTION_ARG_NONE,    keep,       "Don't exit the terminal after child process exits.", 0},
-        {"name",      'n', 0, G_OPTION_ARG_STRING,  name,       "Set first value of WM_CLASS property; second value is always 'TinyTerm' (default: 'tinyterm')", "NAME"},
-        {"title",     't', 0, G_OPTION_ARG_STRING,  title,      "Set value of WM_NAME property; disables window_title_cb (default: 'TinyTerm')", "TITLE"},
-        { NULL }
-    };
+    gsize matched = 0;
 
-    GError* error = NULL;
+    predict_undo(term);
+    predict_track_sgr(term, data, len);
+    if (term->predict->len == 0)
+        return;
+    while (matched < term->predict->len && matched < len && term->predict->str[matched] == data[matched])
+        matched++;
+    if (matched > 0) {
+        g_string_erase(term->predict, 0, matched);
+        term->is_predict_confirmed = TRUE;
+        term->predict_misses = 0;
+    } else {
+        /* the child doesn't echo as predicted, wait for the next line */
+        g_string_truncate(term->predict, 0);
+        term->is_predict_confirmed = FALSE;
+        term->predict_misses++;
+    }
+}
+
+/* keep track of typed text for predictive local echo (--predict) */
+static void
+predict_input(TinyTerm* term, const char* text, guint size)
+{
+    if (size == 1 && text[0] >= 0x20 && text[0] < 0x7f) {
+        if (term->predict_misses < PREDICT_MISSES_MAX && term->predict->len < PREDICT_MAX) {
+            g_string_append_c(term->predict, text[0]);
+            predict_show(term);
+        }
+        return;
+    }
+    /* Enter starts a line that may not be echoed, other keys edit it in unknown ways */
+    g_string_truncate(term->predict, 0);
+    if (memchr(text, '\r', size)) {
+        term->is_predict_confirmed = FALSE;
+        term->predict_misses = 0;
+    }
+}
+
+/* whether output is read in large batches and fed at PTY_FLOOD_FPS: while the child floods
+ * it and nothing was typed for TYPING_TIMEOUT, unless pinned by KEY_SCHEDULE */
+static gboolean
+terminal_is_throughput(TinyTerm* term)
+{
+    if (term->schedule != SCHEDULE_AUTO)
+        return term->schedule == SCHEDULE_THROUGHPUT;
+    return term->is_flooding && g_get_monotonic_time() - term->key_time > TYPING_TIMEOUT * 1000;
+}
+
+/* measure the rate of child output over PTY_FLOOD_WINDOW */
+static void
+terminal_flood_update(TinyTerm* term, gsize len)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 elapsed = now - term->flood_start;
+
+    term->flood_bytes += len;
+    if (elapsed < PTY_FLOOD_WINDOW * 1000)
+        return;
+    term->is_flooding = (gint64) term->flood_bytes * G_USEC_PER_SEC >= (gint64) PTY_FLOOD_RATE * elapsed;
+    term->flood_start = now;
+    term->flood_bytes = 0;
+}
+
+/* interval between feeds of child output to vte in ms, 0 to feed it right away */
+static guint
+terminal_feed_interval(TinyTerm* term)
+{
+    if (is_headless)
+        return 0;
+    if (!term->is_mapped || term->is_obscured || !gtk_widget_get_mapped(GTK_WIDGET (term->vte)))
+        return 1000 / config.hidden_fps;
+    if (!term->has_focus)
+        return 1000 / config.unfocused_fps;
+    if (terminal_is_throughput(term))
+        return 1000 / PTY_FLOOD_FPS;
+    return 0;
+}
+
+static void session_restore_load(TinyTerm* term);
+static void session_restore_free(SessionRestore* restore);
+static gsize terminal_links_resolve(TinyTerm* term, gsize len);
+
+/* pass pending child output to vte */
+static void
+terminal_feed(TinyTerm* term)
+{
+    guint len, i;
+
+    if (term->feed_source) {
+        g_source_remove(term->feed_source);
+        term->feed_source = 0;
+    }
+    if (term->link_wait_source)
+        return;     // see terminal_links_resolve
+    /* a restored pane gets its history back once it is shown, the output of its child waits */
+    if (term->restore) {
+        if (!gtk_widget_get_mapped(GTK_WIDGET (term->vte)) && term->output->len < PTY_OUTPUT_MAX)
+            return;
+        session_restore_load(term);
+    }
+    /* during a synchronized update only the updates completed before are drawn */
+    len = term->is_synchronized && term->output->len < PTY_OUTPUT_MAX ? term->sync_end : term->output->len;
+    len = terminal_links_resolve(term, len);
+    if (len > 0) {
+        gint64 start = g_get_monotonic_time();
+        if (term->predict)
+            predict_reconcile(term, (const char*) term->output->data, len);
+        vte_terminal_feed(term->vte, (const char*) term->output->data, len);
+        term->feed_time += g_get_monotonic_time() - start;
+        term->is_session_dirty = TRUE;
+        term->is_vte_busy = TRUE;
+        g_byte_array_remove_range(term->output, 0, len);
+        for (i = 0; i < term->link_marks->len; i++)
+            g_array_index(term->link_marks, LinkMark, i).offset -= len;
+        term->link_offset = term->link_offset == len ? 0 : G_MAXSIZE;
+        if (term->predict)
+            predict_show(term);
+    }
+    term->sync_end = term->sync_end > len ? term->sync_end - len : 0;
+}
+
+/* callback to feed the output collected by a throttled terminal */
+static gboolean
+terminal_feed_cb(TinyTerm* term)
+{
+    term->feed_source = 0;
+    terminal_feed(term);
+    return FALSE;
+}
+
+/* feed child output now or schedule it according to the refresh rate of the terminal */
+static void
+terminal_feed_schedule(TinyTerm* term)
+{
+    guint interval = terminal_feed_interval(term);
+    guint output_max = terminal_is_throughput(term) ? PTY_FLOOD_OUTPUT_MAX : PTY_OUTPUT_MAX;
+
+    if (interval == 0 || term->output->len >= output_max)
+        terminal_feed(term);
+    else if (term->feed_source)
+        term->frames_skipped++;
+    else if (term->output->len > 0)
+        term->feed_source = g_timeout_add(interval, (GSourceFunc) terminal_feed_cb, term);
+}
+
+/* callback to track focus and visibility of a terminal, which set its refresh rate */
+static gboolean
+terminal_state_cb(GtkWidget* widget, GdkEvent* event, TinyTerm* term)
+{
+    switch (event->type) {
+        case GDK_FOCUS_CHANGE:
+            term->has_focus = event->focus_change.in;
+            break;
+        case GDK_MAP:
+            term->is_mapped = TRUE;
+            break;
+        case GDK_UNMAP:
+            term->is_mapped = FALSE;
+            break;
+        case GDK_VISIBILITY_NOTIFY:
+            term->is_obscured = event->visibility.state == GDK_VISIBILITY_FULLY_OBSCURED;
+            break;
+        default:
+            break;
+    }
+
+    /* a terminal that just became visible is redrawn once with everything collected */
+    terminal_feed(term);
+    return FALSE;
+}
+
+/* callback to pass the map state of a window on to its panes */
+static gboolean
+window_state_cb(GtkWidget* widget, GdkEvent* event, TinyTermWindow* win)
+{
+    GList* l;
+
+    for (l = win->panes; l; l = l->next)
+        terminal_state_cb(widget, event, l->data);
+    return FALSE;
+}
+
+static void tmux_start(TinyTerm* term);
+static void tmux_stop(TmuxClient* tmux);
+static void tmux_free(TmuxClient* tmux);
+static gsize tmux_read(TmuxClient* tmux, const char* data, gsize len);
+static void tmux_command(TmuxClient* tmux, guint reply, guint pane, const char* format, ...) G_GNUC_PRINTF (4, 5);
+static void tmux_input(TinyTerm* term, const char* data, gsize len);
+static void tmux_capture(TinyTerm* term);
+static void tmux_resize(TmuxClient* tmux);
+
+/* callback to feed a pane whose tab was switched to; a tmux pane is captured when first shown */
+static void
+vte_map_cb(GtkWidget* widget, TinyTerm* term)
+{
+    if (term->tmux_state == TMUX_PANE_NEW && term->tmux)
+        tmux_capture(term);
+    terminal_feed(term);
+}
+
+/* callback to make a pane the current one of its window when it gets the focus */
+static gboolean
+terminal_focus_cb(GtkWidget* widget, GdkEventFocus* event, TinyTerm* term)
+{
+    /* history trimmed while the pane wasn't used can grow again */
+    term->focus_time = g_get_monotonic_time();
+    if (term->trimmed_lines) {
+        vte_terminal_set_scrollback_lines(term->vte, config.scrollback_lines < 0 ? G_MAXLONG : config.scrollback_lines);
+        term->trimmed_lines = 0;
+    }
+    if (term->win->current == term)
+        return FALSE;
+    term->win->current = term;
+    set_geometry_hints(term->vte);
+    if (term->title_handler) {
+        if (term->title_source)
+            g_source_remove(term->title_source);
+        window_title_update(term);
+    }
+    return FALSE;
+}
+
+static void pty_write(TinyTerm* term);
+
+/* callback to give up on a synchronized update the child didn't end in time */
+static gboolean
+terminal_sync_timeout_cb(TinyTerm* term)
+{
+    term->sync_source = 0;
+    term->is_synchronized = FALSE;
+    terminal_feed_schedule(term);
+    return FALSE;
+}
+
+/* set a DEC private mode of the child, the ones that matter to tinyterm itself;
+ * end is the pending output up to the end of the sequence */
+static void
+terminal_set_mode(TinyTerm* term, guint mode, gboolean is_set, gsize end)
+{
+    switch (mode) {
+        case 2004:
+            term->bracketed_paste = is_set;
+            break;
+        case 47:
+        case 1047:
+        case 1049:
+            term->is_alternate_screen = is_set;
+            break;
+        case 2026:
+            /* output before the start of an update is fed as the update is held back */
+            if (is_set && !term->is_synchronized)
+                term->sync_end = end;
+            term->is_synchronized = is_set;
+            if (is_set && !term->sync_source) {
+                term->sync_source = g_timeout_add(PTY_SYNC_TIMEOUT, (GSourceFunc) terminal_sync_timeout_cb, term);
+            } else if (!is_set) {
+                term->sync_end = end;
+                if (term->sync_source)
+                    g_source_remove(term->sync_source);
+                term->sync_source = 0;
+            }
+            break;
+    }
+}
+
+/* answer a DECRQM query for the modes vte doesn't know itself */
+static void
+terminal_report_mode(TinyTerm* term, guint mode)
+{
+    char reply[32];
+    gint len;
+
+    if (mode != 2026 || term->tmux_state != TMUX_PANE_NONE)
+        return;     // tmux answers for its panes
+    len = g_snprintf(reply, sizeof(reply), "\033[?%u;%d$y", mode, term->is_synchronized ? 1 : 2);
+    g_byte_array_append(term->input, (guint8*) reply, len);
+    pty_write(term);
+}
+
+/* a hyperlink opened with OSC 8, remembered by the cells it was written to */
+typedef struct {
+    char* uri;
+    glong start_row, start_column;
+    glong end_row, end_column;  // cell after the last one
+} Hyperlink;
+
+static void
+hyperlink_free(Hyperlink* link)
+{
+    g_free(link->uri);
+    g_free(link);
+}
+
+/* whether a cell is in the range of cells from a start up to an end */
+static gboolean
+cell_in_range(glong row, glong column, glong start_row, glong start_column, glong end_row, glong end_column)
+{
+    return (row > start_row || (row == start_row && column >= start_column))
+           && (row < end_row || (row == end_row && column < end_column));
+}
+
+/* handle an OSC sequence ending at an offset of the pending output; only OSC 8 ; params ; URI is
+ * of interest, an empty URI ends the hyperlink. Its cell is known once it is fed to vte */
+static void
+terminal_osc(TinyTerm* term, const char* payload, gsize offset)
+{
+    const char* uri;
+    LinkMark mark;
+
+    if (!g_str_has_prefix(payload, "8;"))
+        return;
+    uri = strchr(payload + 2, ';');
+    mark.offset = offset;
+    mark.uri = uri && uri[1] ? g_strdup(uri + 1) : NULL;
+    g_array_append_val(term->link_marks, mark);
+}
+
+/* forget the OSC 8 sequences of output that is dropped */
+static void
+terminal_links_clear(TinyTerm* term)
+{
+    guint i;
+
+    for (i = 0; i < term->link_marks->len; i++)
+        g_free(g_array_index(term->link_marks, LinkMark, i).uri);
+    g_array_set_size(term->link_marks, 0);
+    term->link_offset = G_MAXSIZE;
+}
+
+/* move the tracked cursor over output that only prints text, moves to the next line and sets
+ * attributes; FALSE for anything else, where only vte knows where the cursor goes */
+static gboolean
+terminal_link_track(TinyTerm* term, const char* data, gsize len)
+{
+    glong columns = vte_terminal_get_column_count(term->vte);
+    const char* end = data + len;
+
+    while (data < end) {
+        guchar c = *data;
+
+        if (c == '\r') {
+            term->link_column = 0;
+            data++;
+        } else if (c == '\n') {
+            term->link_row++;
+            data++;
+        } else if (c == '\033' && data + 1 < end && data[1] == '[') {
+            /* SGR */
+            for (data += 2; data < end && (g_ascii_isdigit(*data) || *data == ';' || *data == ':'); data++)
+                ;
+            if (data == end || *data != 'm')
+                return FALSE;
+            data++;
+        } else if (c == '\033' && data + 1 < end && data[1] == ']') {
+            /* OSC, such as the OSC 8 sequences in between, up to BEL or ST */
+            for (data += 2; data < end && *data != '\007' && *data != '\033'; data++)
+                ;
+            if (data == end || (*data == '\033' && (data + 1 == end || data[1] != '\\')))
+                return FALSE;
+            data += *data == '\007' ? 1 : 2;
+        } else if (c < 0x20 || c == 0x7f) {
+            return FALSE;
+        } else {
+            gunichar u = g_utf8_get_char_validated(data, end - data);
+            glong width;
+            if (u == (gunichar) -1 || u == (gunichar) -2)
+                return FALSE;
+            width = g_unichar_iszerowidth(u) ? 0 : g_unichar_iswide(u) ? 2 : 1;
+            if (term->link_column + width > columns) {
+                term->link_row++;
+                term->link_column = 0;
+            }
+            term->link_column += width;
+            data = g_utf8_next_char(data);
+        }
+    }
+    return TRUE;
+}
+
+/* open or close a hyperlink at the tracked cursor */
+static void
+terminal_link_mark(TinyTerm* term, char* uri)
+{
+    if (term->link_uri && (term->link_row != term->link_start_row || term->link_column != term->link_start_column)) {
+        Hyperlink* link = g_new(Hyperlink, 1);
+        link->uri = term->link_uri;
+        link->start_row = term->link_start_row;
+        link->start_column = term->link_start_column;
+        link->end_row = term->link_row;
+        link->end_column = term->link_column;
+        g_queue_push_head(term->links, link);
+        if (g_queue_get_length(term->links) > LINKS_MAX)
+            hyperlink_free(g_queue_pop_tail(term->links));
+    } else {
+        g_free(term->link_uri);
+    }
+    term->link_uri = uri;
+    term->link_start_row = term->link_row;
+    term->link_start_column = term->link_column;
+}
+
+/* callback to read the cursor once vte processed the output up to an OSC 8 sequence */
+static gboolean
+terminal_link_wait_cb(TinyTerm* term)
+{
+    term->link_wait_source = 0;
+    vte_terminal_get_cursor_position(term->vte, &term->link_column, &term->link_row);
+    term->link_offset = 0;
+    terminal_feed_schedule(term);
+    return FALSE;
+}
+
+/* find the cells of the OSC 8 sequences in the first len bytes of pending output, returns the bytes
+ * that can be fed now. vte processes its input later on, so its cursor is only read at the first
+ * sequence, once vte caught up on the output before it; the cursor is followed from there over
+ * plain text, and vte is waited for again when the output does anything else */
+static gsize
+terminal_links_resolve(TinyTerm* term, gsize len)
+{
+    while (term->link_marks->len > 0) {
+        LinkMark* mark = &g_array_index(term->link_marks, LinkMark, 0);
+
+        if (mark->offset > len)
+            break;
+        if (term->link_offset > mark->offset
+                || !terminal_link_track(term, (const char*) term->output->data + term->link_offset,
+                                        mark->offset - term->link_offset)) {
+            if (mark->offset == 0 && !term->is_vte_busy) {
+                vte_terminal_get_cursor_position(term->vte, &term->link_column, &term->link_row);
+            } else {
+                term->link_wait_source = g_timeout_add(LINK_WAIT_TIMEOUT, (GSourceFunc) terminal_link_wait_cb, term);
+                return mark->offset;
+            }
+        }
+        term->link_offset = mark->offset;
+        terminal_link_mark(term, mark->uri);
+        g_array_remove_index(term->link_marks, 0);
+    }
+    return len;
+}
+
+/* follow the DECSET/DECRST (ESC [ ? Pm h/l) and OSC 8 hyperlink sequences in child output,
+ * which may be split across reads; vte interprets the output as usual. Returns the bytes
+ * scanned, fewer than len if the child switched to tmux control mode (ESC P 1000 p) */
+static gsize
+pty_scan(TinyTerm* term, const char* data, gsize len)
+{
+    enum { GROUND, ESCAPE, CSI, PRIVATE, OSC, OSC_ESCAPE, DCS, DCS_STRING };
+    const char* start = data;
+    const char* end = data + len;
+    guint i;
+
+    while (data < end) {
+        char c = *data;
+
+        switch (term->scan_state) {
+            case GROUND: {
+                const char* escape = memchr(data, '\033', end - data);
+                if (!escape)
+                    return len;
+                data = escape;
+                term->scan_state = ESCAPE;
+                break;
+            }
+            case ESCAPE:
+                if (c == '[') {
+                    term->modes_count = 0;
+                    term->modes[0] = 0;
+                    term->is_mode_request = FALSE;
+                } else if (c == ']') {
+                    g_string_truncate(term->osc, 0);
+                } else if (c == 'P') {
+                    term->modes[0] = 0;
+                }
+                /* intermediate bytes, as in ESC ( B, keep the sequence going */
+                term->scan_state = c == '[' ? CSI : c == ']' ? OSC : c == 'P' ? DCS :
+                                   c == '\033' || (c >= 0x20 && c <= 0x2f) ? ESCAPE : GROUND;
+                break;
+            case CSI:
+                /* parameters of other control sequences are skipped up to the final byte */
+                if (c == '?')
+                    term->scan_state = PRIVATE;
+                else if (c == '\033')
+                    term->scan_state = ESCAPE;
+                else if (c >= 0x40 && c <= 0x7e)
+                    term->scan_state = GROUND;
+                break;
+            case PRIVATE:
+                if (c >= '0' && c <= '9') {
+                    if (term->modes_count < PTY_MODES_MAX)
+                        term->modes[term->modes_count] = term->modes[term->modes_count] * 10 + (c - '0');
+                } else if (c == ';') {
+                    if (++term->modes_count < PTY_MODES_MAX)
+                        term->modes[term->modes_count] = 0;
+                } else if (c == '$') {
+                    term->is_mode_request = TRUE;
+                } else {
+                    if ((c == 'h' || c == 'l') && !term->is_mode_request)
+                        for (i = 0; i <= term->modes_count && i < PTY_MODES_MAX; i++)
+                            terminal_set_mode(term, term->modes[i], c == 'h', term->output->len + (data + 1 - start));
+                    else if (c == 'p' && term->is_mode_request)
+                        terminal_report_mode(term, term->modes[0]);
+                    term->scan_state = c == '\033' ? ESCAPE : GROUND;
+                }
+                break;
+            case OSC:
+                /* terminated by BEL or ST (ESC \) */
+                if (c == '\007') {
+                    terminal_osc(term, term->osc->str, term->output->len + (data + 1 - start));
+                    term->scan_state = GROUND;
+                } else if (c == '\033') {
+                    term->scan_state = OSC_ESCAPE;
+                } else if (term->osc->len < OSC_MAX) {
+                    g_string_append_c(term->osc, c);
+                }
+                break;
+            case OSC_ESCAPE:
+                if (c != '\\') {
+                    term->scan_state = ESCAPE;  // cut short by another escape sequence
+                    continue;
+                }
+                terminal_osc(term, term->osc->str, term->output->len + (data + 1 - start));
+                term->scan_state = GROUND;
+                break;
+            case DCS:
+                /* only the parameter of a DCS sequence is looked at, its string is skipped up to ST */
+                if (c >= '0' && c <= '9') {
+                    term->modes[0] = MIN(term->modes[0] * 10 + (c - '0'), G_MAXUINT16);
+                } else if (c == 'p' && term->modes[0] == 1000 && !term->tmux) {
+                    term->scan_state = GROUND;
+                    tmux_start(term);
+                    return data + 1 - start;
+                } else {
+                    term->scan_state = c == '\033' ? ESCAPE : DCS_STRING;
+                }
+                break;
+            case DCS_STRING:
+                if (c == '\033')
+                    term->scan_state = ESCAPE;
+                break;
+        }
+        data++;
+    }
+    return len;
+}
+
+/* url matches of a row, valid as long as the row shows the same text */
+typedef struct {
+    guint generation;       // contents_generation the text was last fetched at
+    char* text;
+    GArray* attributes;     // VteCharAttributes of every byte of text
+    GArray* urls;           // start and end byte offsets of the matches, in pairs
+} UrlRow;
+
+static void
+url_row_free(UrlRow* cached)
+{
+    g_free(cached->text);
+    g_array_free(cached->attributes, TRUE);
+    g_array_free(cached->urls, TRUE);
+    g_free(cached);
+}
+
+/* url matches of a row, the regex only runs again when the text of the row changed */
+static UrlRow*
+url_row_get(TinyTerm* term, glong row)
+{
+    UrlRow* cached = g_hash_table_lookup(term->url_rows, GINT_TO_POINTER ((gint) row));
+    GArray* attributes;
+    GMatchInfo* match;
+    char* text;
+
+    if (cached && cached->generation == term->contents_generation)
+        return cached;
+
+    attributes = g_array_new(FALSE, FALSE, sizeof(VteCharAttributes));
+    text = vte_terminal_get_text_range(term->vte, row, 0, row,
+                                       vte_terminal_get_column_count(term->vte) - 1, NULL, NULL, attributes);
+    if (!text)
+        text = g_strdup("");
+    if (cached && strcmp(cached->text, text) == 0) {
+        cached->generation = term->contents_generation;
+        g_array_free(attributes, TRUE);
+        g_free(text);
+        return cached;
+    }
+
+    if (!cached) {
+        if (g_hash_table_size(term->url_rows) >= URL_ROWS_MAX)
+            g_hash_table_remove_all(term->url_rows);
+        cached = g_new0(UrlRow, 1);
+        cached->urls = g_array_new(FALSE, FALSE, sizeof(gint));
+        g_hash_table_insert(term->url_rows, GINT_TO_POINTER ((gint) row), cached);
+    } else {
+        g_free(cached->text);
+        g_array_free(cached->attributes, TRUE);
+        g_array_set_size(cached->urls, 0);
+    }
+    cached->generation = term->contents_generation;
+    cached->text = text;
+    cached->attributes = attributes;
+
+    /* every url of url_regex has a scheme, most rows don't need the regex */
+    if (!strstr(text, "://"))
+        return cached;
+    g_regex_match(get_url_regex(), text, 0, &match);
+    while (g_match_info_matches(match)) {
+        gint start, end;
+        g_match_info_fetch_pos(match, 0, &start, &end);
+        g_array_append_val(cached->urls, start);
+        g_array_append_val(cached->urls, end);
+        g_match_info_next(match, NULL);
+    }
+    g_match_info_free(match);
+    return cached;
+}
+
+/* cell of the terminal under a pointer position, the row counts the history */
+static void
+terminal_cell_at(TinyTerm* term, gdouble x, gdouble y, glong* row, glong* column)
+{
+    GtkBorder* border = NULL;
+    gint left = 0, top = 0;
+
+    gtk_widget_style_get(GTK_WIDGET (term->vte), "inner-border", &border, NULL);
+    if (border) {
+        left = border->left;
+        top = border->top;
+        gtk_border_free(border);
+    }
+    *column = (glong) (x - left) / vte_terminal_get_char_width(term->vte);
+    *row = (glong) (y - top) / vte_terminal_get_char_height(term->vte)
+           + (glong) gtk_adjustment_get_value(term->vte->adjustment);
+}
+
+/* URI of the OSC 8 hyperlink or the url shown at a cell, NULL if there is none */
+static char*
+terminal_link_at(TinyTerm* term, glong row, glong column)
+{
+    UrlRow* cached;
+    const VteCharAttributes* attributes;
+    gint offset = -1;
+    guint i;
+    GList* l;
+
+    /* hyperlinks by the cells they were written to, the open one and the most recent first */
+    if (term->link_uri) {
+        glong cursor_row, cursor_column;
+        vte_terminal_get_cursor_position(term->vte, &cursor_column, &cursor_row);
+        if (cell_in_range(row, column, term->link_start_row, term->link_start_column, cursor_row, cursor_column))
+            return g_strdup(term->link_uri);
+    }
+    for (l = term->links->head; l; l = l->next) {
+        const Hyperlink* link = l->data;
+        if (cell_in_range(row, column, link->start_row, link->start_column, link->end_row, link->end_column))
+            return g_strdup(link->uri);
+    }
+
+    /* vte gives the attributes of every byte, wide characters span two columns */
+    cached = url_row_get(term, row);
+    attributes = (const VteCharAttributes*) cached->attributes->data;
+    for (i = 0; i < cached->attributes->len && attributes[i].column <= column; i++)
+        if (attributes[i].row == row)
+            offset = i;
+    if (offset < 0 || column < 0)
+        return NULL;
+
+    for (i = 0; i + 1 < cached->urls->len; i += 2) {
+        gint start = g_array_index(cached->urls, gint, i);
+        gint end = g_array_index(cached->urls, gint, i + 1);
+        if (offset >= start && offset < end)
+            return g_strndup(cached->text + start, end - start);
+    }
+    return NULL;
+}
+
+/* callback to invalidate the cached url matches whenever vte changes contents */
+static void
+vte_contents_cb(VteTerminal* vte, TinyTerm* term)
+{
+    term->contents_generation++;
+    if (latency_probe)
+        latency_probe_changed();
+}
+
+/* callback for vte having processed the output it was fed, the cursor is where the output left it */
+static void
+vte_processed_cb(VteTerminal* vte, TinyTerm* term)
+{
+    term->is_vte_busy = FALSE;
+    if (term->link_wait_source) {
+        g_source_remove(term->link_wait_source);
+        terminal_link_wait_cb(term);
+    }
+}
+
+/* callback to show a hand cursor while Ctrl is held over a link */
+static gboolean
+vte_motion_cb(GtkWidget* widget, GdkEventMotion* event, TinyTerm* term)
+{
+    static GdkCursor* hand_cursor = NULL;
+    static GdkCursor* text_cursor = NULL;
+    gboolean is_link = FALSE;
+    glong row, column;
+    char* uri;
+
+    if (event->state & GDK_CONTROL_MASK) {
+        terminal_cell_at(term, event->x, event->y, &row, &column);
+        /* the row is only looked at again when the pointer moved to another cell or it changed */
+        if (row == term->hover_row && column == term->hover_column
+                && term->hover_generation == term->contents_generation)
+            return FALSE;
+        term->hover_row = row;
+        term->hover_column = column;
+        term->hover_generation = term->contents_generation;
+
+        uri = terminal_link_at(term, row, column);
+        is_link = uri != NULL;
+        g_free(uri);
+    } else {
+        term->hover_row = -1;
+    }
+
+    if (is_link != term->is_hovering_link) {
+        if (!hand_cursor) {
+            hand_cursor = gdk_cursor_new(GDK_HAND2);
+            text_cursor = gdk_cursor_new(GDK_XTERM);
+        }
+        term->is_hovering_link = is_link;
+        gdk_window_set_cursor(gtk_widget_get_window(widget), is_link ? hand_cursor : text_cursor);
+    }
+    return FALSE;
+}
+
+/* callback to open the link under the pointer on Ctrl+click */
+static gboolean
+vte_button_cb(GtkWidget* widget, GdkEventButton* event, TinyTerm* term)
+{
+    glong row, column;
+    char* uri;
+
+    if (event->type != GDK_BUTTON_PRESS || event->button != 1 || !(event->state & GDK_CONTROL_MASK))
+        return FALSE;
+
+    terminal_cell_at(term, event->x, event->y, &row, &column);
+    uri = terminal_link_at(term, row, column);
+    if (!uri)
+        return FALSE;
+    xdg_open(uri);
+    g_free(uri);
+    return TRUE;
+}
+
+/* recording of the output of a pane; the main loop copies output into a ring buffer
+ * without locking and a thread of its own writes it to disk */
+struct _PtyLog {
+    char* path;
+    int fd;
+    GConverter* compressor; // for files ending in .gz
+    char* compressed;       // output of the compressor, LOG_BATCH_SIZE bytes
+    int wakeup;             // eventfd the main loop wakes the writer with
+    volatile gint ref;      // held by the main loop until it closes the log and by the writer
+    char* ring;
+    volatile gint head;     // bytes appended by the main loop, modulo 2^32
+    volatile gint tail;     // bytes written by the writer, modulo 2^32
+    volatile gint is_sleeping;  // the writer waits for wakeup
+    volatile gint is_closing;   // the main loop is done with the log, the writer frees it
+    volatile gint has_failed;
+    guint64 written;        // bytes appended, counted by the main loop
+    guint64 dropped;        // bytes dropped when the ring buffer was full
+};
+
+static gboolean
+log_write_all(PtyLog* log, const char* data, gsize len)
+{
+    while (len > 0) {
+        ssize_t n = write(log->fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            g_printerr("Failed to write %s: %s\n", log->path, g_strerror(errno));
+            return FALSE;
+        }
+        data += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+/* write a batch of output to the log file, compressed if requested */
+static gboolean
+log_write(PtyLog* log, const char* data, gsize len, GConverterFlags flags)
+{
+    GConverterResult result;
+    gsize bytes_read, bytes_written;
+
+    if (!log->compressor)
+        return log_write_all(log, data, len);
+
+    /* zlib fails when it can't make progress, so it's only called again while there is
+     * input left, or while a flush or the end of the stream filled the whole buffer */
+    do {
+        GError* error = NULL;
+        result = g_converter_convert(log->compressor, data, len, log->compressed, LOG_BATCH_SIZE, flags,
+                                     &bytes_read, &bytes_written, &error);
+        if (result == G_CONVERTER_ERROR) {
+            g_printerr("Failed to compress %s: %s\n", log->path, error->message);
+            g_error_free(error);
+            return FALSE;
+        }
+        data += bytes_read;
+        len -= bytes_read;
+        if (!log_write_all(log, log->compressed, bytes_written))
+            return FALSE;
+    } while (len > 0 || (flags == G_CONVERTER_FLUSH && bytes_written == LOG_BATCH_SIZE)
+             || (flags == G_CONVERTER_INPUT_AT_END && result != G_CONVERTER_FINISHED));
+    return TRUE;
+}
+
+/* wait for the main loop to append output or close the log, for at most timeout ms or for good
+ * if it is -1; FALSE if it timed out */
+static gboolean
+log_sleep(PtyLog* log, int timeout)
+{
+    struct pollfd wakeup = { log->wakeup, POLLIN, 0 };
+    guint64 count;
+
+    /* the main loop only wakes the writer once it is about to sleep, see log_wake */
+    g_atomic_int_set(&log->is_sleeping, TRUE);
+    if ((guint) g_atomic_int_get(&log->head) != (guint) log->tail || g_atomic_int_get(&log->is_closing)) {
+        g_atomic_int_set(&log->is_sleeping, FALSE);
+        return TRUE;
+    }
+    if (poll(&wakeup, 1, timeout) <= 0) {
+        g_atomic_int_set(&log->is_sleeping, FALSE);
+        return FALSE;
+    }
+    if (read(log->wakeup, &count, sizeof(count)) < 0)
+        return FALSE;
+    return TRUE;
+}
+
+static void
+log_unref(PtyLog* log)
+{
+    if (!g_atomic_int_dec_and_test(&log->ref))
+        return;
+    if (log->dropped > 0)
+        g_printerr("%s: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " bytes of output not logged\n",
+                   log->path, log->dropped, log->written + log->dropped);
+    close(log->fd);
+    close(log->wakeup);
+    if (log->compressor)
+        g_object_unref(log->compressor);
+    g_free(log->compressed);
+    g_free(log->ring);
+    g_free(log->path);
+    g_free(log);
+}
+
+/* thread writing the ring buffer to disk in batches, as large as the output since its last wakeup;
+ * it frees the log once the main loop closed it and everything is written */
+static gpointer
+log_writer(PtyLog* log)
+{
+    gboolean is_dirty = FALSE;  // compressed output not flushed to the file yet
+    gboolean is_ok = TRUE;
+
+    for (;;) {
+        guint tail = (guint) log->tail;
+        guint head = (guint) g_atomic_int_get(&log->head);
+        guint offset = tail & (LOG_RING_SIZE - 1);
+        guint len = MIN(head - tail, LOG_RING_SIZE - offset);
+
+        if (len == 0) {
+            if (g_atomic_int_get(&log->is_closing))
+                break;
+            /* flush compressed output once idle, so it isn't lost if tinyterm dies */
+            if (log_sleep(log, is_dirty ? LOG_INTERVAL : -1) || !is_dirty)
+                continue;
+            if (!(is_ok = log_write(log, NULL, 0, G_CONVERTER_FLUSH)))
+                break;
+            is_dirty = FALSE;
+            continue;
+        }
+        if (!(is_ok = log_write(log, log->ring + offset, len, G_CONVERTER_NO_FLAGS)))
+            break;
+        is_dirty = log->compressor != NULL;
+        g_atomic_int_set(&log->tail, (gint) (tail + len));
+    }
+    if (log->compressor && is_ok)
+        log_write(log, NULL, 0, G_CONVERTER_INPUT_AT_END);
+    g_atomic_int_set(&log->has_failed, TRUE);
+
+    /* after a failure the main loop still counts what it drops, until it closes the log */
+    while (!g_atomic_int_get(&log->is_closing))
+        log_sleep(log, -1);
+    log_unref(log);
+    return NULL;
+}
+
+/* wake the writer if it waits for output */
+static void
+log_wake(PtyLog* log)
+{
+    guint64 count = 1;
+
+    if (g_atomic_int_compare_and_exchange(&log->is_sleeping, TRUE, FALSE) && write(log->wakeup, &count, sizeof(count)) < 0)
+        g_printerr("Failed to wake the writer of %s: %s\n", log->path, g_strerror(errno));
+}
+
+/* start recording child output to a file, appended to; NULL on failure */
+static PtyLog*
+log_open(const char* path)
+{
+    PtyLog* log;
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    int wakeup = fd < 0 ? -1 : eventfd(0, EFD_CLOEXEC);
+
+    if (wakeup < 0) {
+        g_printerr("Failed to open %s: %s\n", path, g_strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    log = g_new0(PtyLog, 1);
+    log->path = g_strdup(path);
+    log->fd = fd;
+    log->wakeup = wakeup;
+    log->ref = 2;
+    if (g_str_has_suffix(path, ".gz")) {
+        log->compressor = G_CONVERTER (g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+        log->compressed = g_malloc(LOG_BATCH_SIZE);
+    }
+    log->ring = g_malloc(LOG_RING_SIZE);
+    #if GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_unref(g_thread_new("log", (GThreadFunc) log_writer, log));
+    #else
+    g_thread_create((GThreadFunc) log_writer, log, FALSE, NULL);
+    #endif
+    return log;
+}
+
+/* copy child output for the log writer; it is dropped if the writer fell behind, never waited for */
+static void
+log_append(PtyLog* log, const char* data, gsize len)
+{
+    guint head = (guint) log->head;
+    guint used = head - (guint) g_atomic_int_get(&log->tail);
+    guint offset = head & (LOG_RING_SIZE - 1);
+    guint first;
+
+    if (len > LOG_RING_SIZE - used || g_atomic_int_get(&log->has_failed)) {
+        log->dropped += len;
+        return;
+    }
+    first = MIN(len, LOG_RING_SIZE - offset);
+    memcpy(log->ring + offset, data, first);
+    memcpy(log->ring, data + first, len - first);
+    log->written += len;
+    g_atomic_int_set(&log->head, (gint) (head + len));
+    log_wake(log);
+}
+
+/* stop recording; the writer writes what's left in the ring buffer and frees the log */
+static void
+log_close(PtyLog* log)
+{
+    guint64 count = 1;
+
+    g_atomic_int_set(&log->is_closing, TRUE);
+    if (write(log->wakeup, &count, sizeof(count)) < 0)
+        g_printerr("Failed to wake the writer of %s: %s\n", log->path, g_strerror(errno));
+    log_unref(log);
+}
+
+/* start or stop recording the output of a pane to a file named after TINYTERM_LOG_FILE */
+static void
+terminal_log_toggle(TinyTerm* term)
+{
+    GDateTime* now;
+    char* name;
+    char* path;
+
+    if (term->log) {
+        log_close(term->log);
+        term->log = NULL;
+        return;
+    }
+    now = g_date_time_new_now_local();
+    name = g_date_time_format(now, TINYTERM_LOG_FILE);
+    path = g_build_filename(g_get_home_dir(), name, NULL);
+    term->log = log_open(path);
+    g_date_time_unref(now);
+    g_free(name);
+    g_free(path);
+}
+
+/* add child output to the pending output, or pass it to the tmux client the child runs */
+static void
+terminal_output(TinyTerm* term, const char* data, gsize len)
+{
+    while (len > 0) {
+        gsize n;
+
+        if (term->tmux) {
+            n = tmux_read(term->tmux, data, len);
+        } else {
+            n = pty_scan(term, data, len);
+            g_byte_array_append(term->output, (guint8*) data, n);
+            if (term->tmux) {
+                /* tmux never ends the DCS that starts control mode, vte must not see it;
+                 * the ESC P is looked for in the pending output, it may come from an earlier read */
+                guint escape = term->output->len;
+                while (escape > 0 && term->output->data[--escape] != '\033')
+                    ;
+                if (term->output->len - escape >= 3 && memcmp(term->output->data + escape, "\033P", 2) == 0)
+                    g_byte_array_set_size(term->output, escape);
+                g_byte_array_append(term->output, (guint8*) TMUX_GATEWAY_NOTE, strlen(TMUX_GATEWAY_NOTE));
+            }
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/* read one chunk of child output into the pending output, returns the result of read() */
+static ssize_t
+pty_read(TinyTerm* term)
+{
+    static char buffer[PTY_READ_SIZE];
+    ssize_t n = read(vte_pty_get_fd(term->pty), buffer, sizeof(buffer));
+
+    if (n > 0) {
+        if (!term->has_output)
+            timing_mark("first child output");
+        term->has_output = TRUE;
+        term->bytes_read += n;
+        if (latency_probe)
+            latency_probe_mark(LATENCY_READ);
+        if (term->log)
+            log_append(term->log, buffer, n);
+        terminal_output(term, buffer, n);
+    }
+    return n;
+}
+
+/* callback to collect child output as it arrives; a flooding child is read until the pty
+ * is drained or PTY_FLOOD_BATCH was read, otherwise one read is handled at a time */
+static gboolean
+pty_read_cb(GIOChannel* source, GIOCondition condition, TinyTerm* term)
+{
+    gsize budget = terminal_is_throughput(term) ? PTY_FLOOD_BATCH : 1;
+    gsize total = 0;
+    ssize_t n;
+
+    while ((n = pty_read(term)) > 0 && (total += n) < budget)
+        ;
+    if (total > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR))) {
+        terminal_flood_update(term, total);
+        terminal_feed_schedule(term);
+        return TRUE;
+    }
+
+    /* EOF or EIO: every process holding the pty slave has exited */
+    term->pty_read_watch = 0;
+    term->is_synchronized = FALSE;
+    terminal_feed(term);
+    return FALSE;
+}
+
+/* write as much queued input to the child as it accepts, FALSE if the child is gone */
+static gboolean
+pty_flush_input(TinyTerm* term)
+{
+    ssize_t n = write(vte_pty_get_fd(term->pty), term->input->data, term->input->len);
+
+    if (n > 0) {
+        term->bytes_written += n;
+        if (latency_probe)
+            latency_probe_mark(LATENCY_WRITE);
+        g_byte_array_remove_range(term->input, 0, n);
+    } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+        g_byte_array_set_size(term->input, 0);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* show the progress of a large paste in the window title */
+static void
+paste_progress(TinyTerm* term)
+{
+    gint percent = (gint64) term->paste_offset * 100 / term->paste->len;
+    char* accel;
+    char* title;
+
+    if (term->paste->len < PASTE_PROGRESS_MIN || percent == term->paste_percent || term != term->win->current)
+        return;
+    if (!term->paste_title)
+        term->paste_title = g_strdup(gtk_window_get_title(GTK_WINDOW (term->win->window)));
+    term->paste_percent = percent;
+    accel = gtk_accelerator_get_label(config.keys[KEY_PASTE], TINYTERM_MODIFIER);
+    title = g_strdup_printf("Pasting %d%% (%s to cancel)", percent, accel);
+    gtk_window_set_title(GTK_WINDOW (term->win->window), title);
+    g_free(title);
+    g_free(accel);
+}
+
+/* end a paste; the rest of a cancelled one is dropped, but not its closing bracket */
+static void
+paste_stop(TinyTerm* term)
+{
+    guint keep = term->paste_offset;
+
+    /* chunks end on character boundaries, but be sure not to drop half a character */
+    while (keep < term->paste_keep && (term->paste->data[keep] & 0xC0) == 0x80)
+        keep++;
+    g_byte_array_append(term->input, term->paste->data + term->paste_offset, keep - term->paste_offset);
+    keep = MAX(keep, term->paste_keep);
+    g_byte_array_append(term->input, term->paste->data + keep, term->paste->len - keep);
+    g_byte_array_free(term->paste, TRUE);
+    term->paste = NULL;
+    if (term->paste_title) {
+        gtk_window_set_title(GTK_WINDOW (term->win->window), term->paste_title);
+        g_free(term->paste_title);
+        term->paste_title = NULL;
+        if (term->title_handler)
+            window_title_update(term);
+    }
+}
+
+/* queue the next chunk of a paste once the child has read the previous one */
+static void
+paste_next_chunk(TinyTerm* term)
+{
+    guint n;
+
+    if (!term->paste || term->input->len > 0)
+        return;
+    n = MIN(PASTE_CHUNK_SIZE, term->paste->len - term->paste_offset);
+    /* end the chunk on a character boundary, so input typed meanwhile doesn't split one */
+    while (term->paste_offset + n < term->paste->len && n > 1 && (term->paste->data[term->paste_offset + n] & 0xC0) == 0x80)
+        n--;
+    g_byte_array_append(term->input, term->paste->data + term->paste_offset, n);
+    term->paste_offset += n;
+    if (term->paste_offset == term->paste->len)
+        paste_stop(term);
+    else
+        paste_progress(term);
+}
+
+/* callback to write queued input once the child reads again, one paste chunk at a time */
+static gboolean
+pty_write_cb(GIOChannel* source, GIOCondition condition, TinyTerm* term)
+{
+    paste_next_chunk(term);
+    if (!pty_flush_input(term) && term->paste)
+        paste_stop(term);
+    if (term->input->len > 0 || term->paste)
+        return TRUE;
+    term->pty_write_watch = 0;
+    return FALSE;
+}
+
+/* write input to the child, the rest is written by pty_write_cb when it reads again */
+static void
+pty_write(TinyTerm* term)
+{
+    if (!term->pty_write_watch && pty_write_cb(NULL, G_IO_OUT, term))
+        term->pty_write_watch = g_io_add_watch(term->pty_channel, G_IO_OUT, (GIOFunc) pty_write_cb, term);
+}
+
+/* callback to send keyboard input and terminal responses to the child */
+static void
+vte_commit_cb(VteTerminal* vte, char* text, guint size, TinyTerm* term)
+{
+    if (term->tmux) {
+        /* tmux answers queries in the output of its panes itself, only user input is sent */
+        if (term == term->tmux->gateway || gtk_get_current_event_time() != GDK_CURRENT_TIME)
+            tmux_input(term, text, size);
+        return;
+    }
+    if (!term->pty)
+        return;
+
+    if (term->predict)
+        predict_input(term, text, size);
+    /* input during a paste goes ahead of its remaining chunks, outside of the brackets */
+    if (term->paste && term->is_paste_bracketed && term->paste_offset > 0 && term->paste_offset < term->paste_keep) {
+        g_byte_array_append(term->input, (guint8*) "\033[201~", 6);
+        g_byte_array_append(term->input, (guint8*) text, size);
+        g_byte_array_append(term->input, (guint8*) "\033[200~", 6);
+    } else
+        g_byte_array_append(term->input, (guint8*) text, size);
+    pty_write(term);
+}
+
+/* callback to start streaming the clipboard to a pane which is still open */
+static void
+paste_received_cb(GtkClipboard* clipboard, const char* text, VteTerminal* vte)
+{
+    TinyTerm* term = NULL;
+    GList* l;
+    const char* end;
+    char* p;
+
+    for (l = terminals; l; l = l->next)
+        if (((TinyTerm*) l->data)->vte == vte)
+            term = l->data;
+    g_object_unref(vte);
+    if (!term || !(term->pty || term->tmux) || term->paste || !text || !*text)
+        return;
+
+    /* like vte_terminal_paste_clipboard, send newlines as carriage returns */
+    term->paste = g_byte_array_new();
+    term->paste_offset = 0;
+    term->paste_percent = -1;
+    term->is_paste_bracketed = term->bracketed_paste;
+    if (term->bracketed_paste) {
+        g_byte_array_append(term->paste, (guint8*) "\033[200~", 6);
+        /* the text must not end the bracketed paste early */
+        for (; (end = strstr(text, "\033[201~")); text = end + 6)
+            g_byte_array_append(term->paste, (guint8*) text, end - text);
+    }
+    g_byte_array_append(term->paste, (guint8*) text, strlen(text));
+    for (p = (char*) term->paste->data; (p = memchr(p, '\n', term->paste->data + term->paste->len - (guint8*) p)); p++)
+        *p = '\r';
+    term->paste_keep = term->paste->len;
+    if (term->bracketed_paste)
+        g_byte_array_append(term->paste, (guint8*) "\033[201~", 6);
+    if (term->tmux) {
+        /* tmux queues the keys of its panes itself */
+        tmux_input(term, (const char*) term->paste->data, term->paste->len);
+        g_byte_array_free(term->paste, TRUE);
+        term->paste = NULL;
+        return;
+    }
+    pty_write(term);
+}
+
+/* paste the clipboard in chunks as the child reads them, or cancel a paste in progress */
+static void
+terminal_paste(TinyTerm* term)
+{
+    GtkClipboard* clipboard = gtk_widget_get_clipboard(GTK_WIDGET (term->vte), GDK_SELECTION_CLIPBOARD);
+
+    if (term->paste) {
+        paste_stop(term);
+        pty_write(term);
+        return;
+    }
+    gtk_clipboard_request_text(clipboard, (GtkClipboardTextReceivedFunc) paste_received_cb, g_object_ref(term->vte));
+}
+
+/* callback to pass the size of the terminal on to the pty */
+static void
+vte_size_cb(GtkWidget* widget, GtkAllocation* allocation, TinyTerm* term)
+{
+    glong rows = vte_terminal_get_row_count(term->vte);
+    glong columns = vte_terminal_get_column_count(term->vte);
+
+    if (term->pty && (rows != term->pty_rows || columns != term->pty_columns)) {
+        vte_pty_set_size(term->pty, rows, columns, NULL);
+        term->pty_rows = rows;
+        term->pty_columns = columns;
+    }
+    /* the pane running tmux -CC has the size of a tab, which is that of the tmux client */
+    if (term->tmux && term == term->tmux->gateway)
+        tmux_resize(term->tmux);
+}
+
+/* callbacks to time the frames drawn by a terminal (--stats) */
+static gboolean
+vte_frame_start_cb(GtkWidget* widget, GdkEventExpose* event, TinyTerm* term)
+{
+    term->frame_start = g_get_monotonic_time();
+    return FALSE;
+}
+
+static gboolean
+vte_frame_end_cb(GtkWidget* widget, GdkEventExpose* event, TinyTerm* term)
+{
+    gint64 time = g_get_monotonic_time() - term->frame_start;
+
+    if (!term->frame_times)
+        term->frame_times = g_new(guint32, STATS_FRAMES);
+    term->frame_times[term->frames % STATS_FRAMES] = MIN(time, G_MAXUINT32);
+    term->frame_time += time;
+    term->frames++;
+    if (latency_probe)
+        latency_probe_mark(LATENCY_DRAWN);
+    return FALSE;
+}
+
+/* callbacks to count title changes and bells (--stats) */
+static void
+vte_title_count_cb(VteTerminal* vte, TinyTerm* term)
+{
+    term->titles++;
+}
+
+static void
+vte_bell_cb(VteTerminal* vte, TinyTerm* term)
+{
+    term->bells++;
+}
+
+static void child_exit_cb(GPid pid, gint status, TinyTerm* term);
+
+/* create a pty of the given size and spawn a command on it, the user shell if NULL */
+static gboolean
+pty_spawn(char* working_directory, char* command, char** environment, glong rows, glong columns,
+          VtePty** pty_out, GPid* pid)
+{
+    GError* error = NULL;
+    char** command_argv = NULL;
+    char** env;
+    char tty[64];
+    int fd, spawn_error;
+
+    /* Parse command into array */
+    if (!command)
+        command = vte_get_user_shell();
+    g_shell_parse_argv(command, NULL, &command_argv, &error);
+    if (error) {
+        g_printerr("Failed to parse command: %s\n", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    /* Create pty object; vte only sees its output through terminal_feed */
+    VtePty* pty = vte_pty_new(VTE_PTY_NO_HELPER, &error);
+    if (error) {
+        g_printerr("Failed to create pty: %s\n", error->message);
+        g_error_free(error);
+        g_strfreev(command_argv);
+        return FALSE;
+    }
+    vte_pty_set_size(pty, rows, columns, NULL);
+    fd = vte_pty_get_fd(pty);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    timing_mark("vte_spawn: pty creation");
+
+    /* Spawn default shell (or specified command) on the pty slave, which
+     * does what vte_pty_child_setup would do in a forked child */
+    env = environment ? g_strdupv(environment) : g_get_environ();
+    env = g_environ_setenv(env, "TERM", TINYTERM_TERMINFO, TRUE);
+    spawn_error = ptsname_r(fd, tty, sizeof(tty));
+    if (spawn_error == 0)
+        spawn_error = spawn_async(command_argv, env, working_directory, tty, pid);
+    timing_mark("vte_spawn: posix_spawn");
+    g_strfreev(command_argv);
+    g_strfreev(env);
+    if (spawn_error) {
+        g_printerr("Failed to execute child process \"%s\": %s\n", command, g_strerror(spawn_error));
+        g_object_unref(pty);
+        return FALSE;
+    }
+    *pty_out = pty;
+    return TRUE;
+}
+
+/* make a spawned child the one of a pane */
+static void
+terminal_attach(TinyTerm* term, VtePty* pty, GPid pid, glong rows, glong columns)
+{
+    term->pty = pty;
+    term->pty_rows = rows;
+    term->pty_columns = columns;
+    term->child_pid = pid;
+    term->child_watch = g_child_watch_add(term->child_pid, (GChildWatchFunc) child_exit_cb, term);
+    term->pty_channel = g_io_channel_unix_new(vte_pty_get_fd(pty));
+    term->pty_read_watch = g_io_add_watch(term->pty_channel, G_IO_IN | G_IO_HUP | G_IO_ERR, (GIOFunc) pty_read_cb, term);
+}
+
+static gboolean
+vte_spawn(TinyTerm* term, char* working_directory, char* command, char** environment)
+{
+    glong rows = vte_terminal_get_row_count(term->vte);
+    glong columns = vte_terminal_get_column_count(term->vte);
+    VtePty* pty;
+    GPid pid;
+
+    if (!pty_spawn(working_directory, command, environment, rows, columns, &pty, &pid))
+        return FALSE;
+    terminal_attach(term, pty, pid, rows, columns);
+    return TRUE;
+}
+
+/* history rows of a pane, copied out of vte for the search worker */
+typedef struct {
+    gint ref;
+    glong first_row;
+    guint row_count;
+    GString* text;
+    guint* rows;            // offset of every row in text
+    guint64 trigrams[64];   // bloom filter of the lowercase trigrams of text, set by the worker
+} SearchBlock;
+
+/* search index of a pane, shared with the jobs of the worker */
+struct _SearchIndex {
+    gint ref;
+    gint generation;        // incremented by every search, cancels the older ones
+    TinyTerm* term;         // NULL once the pane is closed or the search bar hidden
+    GPtrArray* blocks;      // indexed history, oldest first
+    glong indexed_row;      // first row not in a block yet
+    guint index_source;
+    GRegex* regex;          // current search
+    gboolean is_partial;    // the current search ran before the index caught up
+    GArray* hits;           // rows with a match, oldest first
+    guint hit;
+};
+
+/* a block to index or a search to run in the worker */
+typedef struct {
+    SearchIndex* index;
+    SearchBlock* block;     // block to index, NULL for a search
+    gint generation;
+    GRegex* regex;
+    char* literal;          // lowercase pattern if it has no regex syntax, NULL otherwise
+    GPtrArray* blocks;
+    GArray* hits;
+} SearchJob;
+
+static GThreadPool* search_pool = NULL;
+
+static SearchBlock*
+search_block_ref(SearchBlock* block)
+{
+    g_atomic_int_inc(&block->ref);
+    return block;
+}
+
+static void
+search_block_unref(SearchBlock* block)
+{
+    if (!g_atomic_int_dec_and_test(&block->ref))
+        return;
+    g_string_free(block->text, TRUE);
+    g_free(block->rows);
+    g_free(block);
+}
+
+static void
+search_index_unref(SearchIndex* index)
+{
+    if (!g_atomic_int_dec_and_test(&index->ref))
+        return;
+    g_ptr_array_free(index->blocks, TRUE);
+    if (index->regex)
+        g_regex_unref(index->regex);
+    g_array_free(index->hits, TRUE);
+    g_free(index);
+}
+
+/* copy rows out of vte, remembering where every row starts */
+static SearchBlock*
+search_block_new(VteTerminal* vte, glong first_row, guint row_count)
+{
+    SearchBlock* block = g_new0(SearchBlock, 1);
+    GArray* attributes = g_array_new(FALSE, FALSE, sizeof(VteCharAttributes));
+    char* text = vte_terminal_get_text_range(vte, first_row, 0, first_row + row_count - 1,
+                                             vte_terminal_get_column_count(vte) - 1, NULL, NULL, attributes);
+    guint i, row = 0;
+
+    block->ref = 1;
+    block->first_row = first_row;
+    block->row_count = row_count;
+    block->text = g_string_new(text);
+    block->rows = g_new0(guint, row_count);
+
+    /* vte gives the attributes of every byte, wrapped rows end without a newline */
+    for (i = 0; i < attributes->len && i < block->text->len; i++) {
+        glong attr_row = g_array_index(attributes, VteCharAttributes, i).row - first_row;
+        while (row < row_count && (glong) row <= attr_row)
+            block->rows[row++] = i;
+    }
+    while (row < row_count)
+        block->rows[row++] = block->text->len;
+    g_array_free(attributes, TRUE);
+    g_free(text);
+    return block;
+}
+
+/* bit of a trigram in the bloom filter of a block */
+static inline guint
+search_trigram(const guchar* p)
+{
+    return (g_ascii_tolower(p[0]) * 961 + g_ascii_tolower(p[1]) * 31 + g_ascii_tolower(p[2])) & 4095;
+}
+
+/* whether a block may contain a literal pattern, going by its trigrams */
+static gboolean
+search_block_may_match(const SearchBlock* block, const char* literal)
+{
+    gsize i, len = strlen(literal);
+
+    for (i = 0; i + 3 <= len; i++) {
+        guint bit = search_trigram((const guchar*) literal + i);
+        if (!(block->trigrams[bit / 64] & (G_GUINT64_CONSTANT(1) << (bit % 64))))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* add the rows of a block with a match to the hits */
+static void
+search_block_match(const SearchBlock* block, GRegex* regex, GArray* hits)
+{
+    GMatchInfo* match;
+    glong last = -1;
+    guint row = 0;
+
+    g_regex_match_full(regex, block->text->str, block->text->len, 0, 0, &match, NULL);
+    while (g_match_info_matches(match)) {
+        gint start;
+        g_match_info_fetch_pos(match, 0, &start, NULL);
+        while (row + 1 < block->row_count && block->rows[row + 1] <= (guint) start)
+            row++;
+        if (block->first_row + row != last) {
+            last = block->first_row + row;
+            g_array_append_val(hits, last);
+        }
+        g_match_info_next(match, NULL);
+    }
+    g_match_info_free(match);
+}
+
+static gboolean search_done_cb(SearchJob* job);
+
+/* worker thread: index a block or run a search over the blocks of a job */
+static void
+search_worker(SearchJob* job, gpointer data)
+{
+    guint i;
+
+    if (job->block) {
+        SearchBlock* block = job->block;
+        for (i = 0; i + 3 <= block->text->len; i++) {
+            guint bit = search_trigram((const guchar*) block->text->str + i);
+            block->trigrams[bit / 64] |= G_GUINT64_CONSTANT(1) << (bit % 64);
+        }
+        search_block_unref(block);
+        search_index_unref(job->index);
+        g_free(job);
+        return;
+    }
+    for (i = 0; i < job->blocks->len; i++) {
+        SearchBlock* block = g_ptr_array_index(job->blocks, i);
+        if (g_atomic_int_get(&job->index->generation) != job->generation)
+            break;
+        if (!job->literal || search_block_may_match(block, job->literal))
+            search_block_match(block, job->regex, job->hits);
+    }
+    g_idle_add((GSourceFunc) search_done_cb, job);
+}
+
+/* scroll to the current hit and let vte select the match, it is among the visible rows */
+static void
+search_show_hit(SearchIndex* index)
+{
+    VteTerminal* vte = index->term->vte;
+    GtkAdjustment* adjustment = vte->adjustment;
+    glong row = g_array_index(index->hits, glong, index->hit);
+    gdouble value = row - vte_terminal_get_row_count(vte) + 1;
+
+    value = CLAMP(value, gtk_adjustment_get_lower(adjustment),
+                  gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_page_size(adjustment));
+    gtk_adjustment_set_value(adjustment, value);
+    vte_terminal_select_none(vte);
+    vte_terminal_search_find_previous(vte);
+}
+
+/* callback to take the hits of a search back to the UI thread */
+static gboolean
+search_done_cb(SearchJob* job)
+{
+    SearchIndex* index = job->index;
+    GtkWidget* entry;
+    GdkColor color;
+
+    if (index->term && job->generation == index->generation) {
+        g_array_free(index->hits, TRUE);
+        index->hits = job->hits;
+        job->hits = NULL;
+        entry = index->term->win->search;
+        gdk_color_parse(TINYTERM_COLOR_SEARCH_FAILED, &color);
+        gtk_widget_modify_base(entry, GTK_STATE_NORMAL, index->hits->len > 0 || !index->regex ? NULL : &color);
+        if (index->hits->len > 0) {
+            index->hit = index->hits->len - 1;
+            search_show_hit(index);
+        }
+    }
+    if (job->hits)
+        g_array_free(job->hits, TRUE);
+    g_ptr_array_free(job->blocks, TRUE);
+    g_regex_unref(job->regex);
+    g_free(job->literal);
+    search_index_unref(index);
+    g_free(job);
+    return FALSE;
+}
+
+/* search the index and the rows not indexed yet for the current regex */
+static void
+search_start(SearchIndex* index)
+{
+    VteTerminal* vte = index->term->vte;
+    glong upper = gtk_adjustment_get_upper(vte->adjustment);
+    glong first = MAX(index->indexed_row, upper - vte_terminal_get_row_count(vte));
+    SearchJob* job;
+    char* escaped;
+    guint i;
+
+    g_atomic_int_inc(&index->generation);
+    if (!index->regex) {
+        g_array_set_size(index->hits, 0);
+        return;
+    }
+    job = g_new0(SearchJob, 1);
+    job->index = index;
+    g_atomic_int_inc(&index->ref);
+    job->generation = g_atomic_int_get(&index->generation);
+    job->regex = g_regex_ref(index->regex);
+    job->blocks = g_ptr_array_new_with_free_func((GDestroyNotify) search_block_unref);
+    job->hits = g_array_new(FALSE, FALSE, sizeof(glong));
+    for (i = 0; i < index->blocks->len; i++)
+        g_ptr_array_add(job->blocks, search_block_ref(g_ptr_array_index(index->blocks, i)));
+
+    /* the screen, and what was added to the history since the last block, are copied now;
+     * while the index catches up the search is repeated once it is done */
+    index->is_partial = first - index->indexed_row > SEARCH_BLOCK_ROWS;
+    if (!index->is_partial)
+        first = index->indexed_row;
+    if (upper > first)
+        g_ptr_array_add(job->blocks, search_block_new(vte, first, upper - first));
+
+    /* a pattern without regex syntax can skip blocks by their trigrams */
+    escaped = g_regex_escape_string(g_regex_get_pattern(index->regex), -1);
+    if (strcmp(escaped, g_regex_get_pattern(index->regex)) == 0)
+        job->literal = g_ascii_strdown(escaped, -1);
+    g_free(escaped);
+    g_thread_pool_push(search_pool, job, NULL);
+}
+
+/* callback to copy one block of history per main loop iteration into the index */
+static gboolean
+search_index_cb(SearchIndex* index)
+{
+    VteTerminal* vte = index->term->vte;
+    glong lower = gtk_adjustment_get_lower(vte->adjustment);
+    glong history = gtk_adjustment_get_upper(vte->adjustment) - vte_terminal_get_row_count(vte);
+    SearchJob* job;
+
+    /* drop blocks that were scrolled out of the history */
+    while (index->blocks->len > 0) {
+        SearchBlock* block = g_ptr_array_index(index->blocks, 0);
+        if (block->first_row + (glong) block->row_count > lower)
+            break;
+        g_ptr_array_remove_index(index->blocks, 0);
+    }
+    index->indexed_row = MAX(index->indexed_row, lower);
+    if (history - index->indexed_row < SEARCH_BLOCK_ROWS) {
+        gtk_entry_set_progress_fraction(GTK_ENTRY (index->term->win->search), 0.0);
+        if (index->is_partial)
+            search_start(index);
+        index->index_source = 0;
+        return FALSE;
+    }
+
+    job = g_new0(SearchJob, 1);
+    job->index = index;
+    g_atomic_int_inc(&index->ref);
+    job->block = search_block_new(vte, index->indexed_row, SEARCH_BLOCK_ROWS);
+    g_ptr_array_add(index->blocks, search_block_ref(job->block));
+    g_thread_pool_push(search_pool, job, NULL);
+    index->indexed_row += SEARCH_BLOCK_ROWS;
+    gtk_entry_set_progress_fraction(GTK_ENTRY (index->term->win->search),
+                                    (gdouble) (index->indexed_row - lower) / MAX(history - lower, 1));
+    return TRUE;
+}
+
+/* bring the index of a pane up to date in the background */
+static void
+search_index_update(SearchIndex* index)
+{
+    if (!index->index_source)
+        index->index_source = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc) search_index_cb, index, NULL);
+}
+
+/* callback to search as the pattern is typed, smart case: caseless unless it has capitals */
+static void
+search_changed_cb(GtkEditable* editable, TinyTermWindow* win)
+{
+    SearchIndex* index = win->search_term->search;
+    const char* pattern = gtk_entry_get_text(GTK_ENTRY (editable));
+    GRegexCompileFlags flags = G_REGEX_OPTIMIZE | G_REGEX_MULTILINE;
+    const char* p;
+
+    for (p = pattern; *p && !g_ascii_isupper(*p); p++)
+        ;
+    if (!*p)
+        flags |= G_REGEX_CASELESS;
+    if (index->regex)
+        g_regex_unref(index->regex);
+    index->regex = *pattern ? g_regex_new(pattern, flags, 0, NULL) : NULL;
+    if (!index->regex && *pattern) {
+        char* escaped = g_regex_escape_string(pattern, -1);     // not a valid regex yet
+        index->regex = g_regex_new(escaped, flags, 0, NULL);
+        g_free(escaped);
+    }
+    vte_terminal_search_set_gregex(win->search_term->vte, index->regex ? index->regex : get_url_regex());
+    gtk_widget_modify_base(GTK_WIDGET (editable), GTK_STATE_NORMAL, NULL);
+    search_index_update(index);
+    search_start(index);
+}
+
+/* hide the search bar and forget the index of the pane that was searched */
+static void
+search_close(TinyTermWindow* win)
+{
+    TinyTerm* term = win->search_term;
+
+    if (!term)
+        return;
+    win->search_term = NULL;
+    if (term->search->index_source)
+        g_source_remove(term->search->index_source);
+    g_atomic_int_inc(&term->search->generation);
+    term->search->term = NULL;
+    search_index_unref(term->search);
+    term->search = NULL;
+    vte_terminal_search_set_gregex(term->vte, get_url_regex());
+    gtk_widget_hide(win->search);
+}
+
+/* callback to move between hits with Return (older) and Shift+Return (newer), Escape closes */
+static gboolean
+search_key_cb(GtkWidget* widget, GdkEventKey* event, TinyTermWindow* win)
+{
+    SearchIndex* index = win->search_term->search;
+    VteTerminal* vte = win->search_term->vte;
+
+    switch (event->keyval) {
+        case GDK_Escape:
+            search_close(win);
+            gtk_widget_grab_focus(GTK_WIDGET (vte));
+            return TRUE;
+        case GDK_Return:
+        case GDK_KP_Enter:
+            if (index->hits->len == 0)
+                return TRUE;
+            if (event->state & GDK_SHIFT_MASK) {
+                if (index->hit + 1 < index->hits->len)
+                    index->hit++;
+                else if (TINYTERM_SEARCH_WRAP_AROUND)
+                    index->hit = 0;
+            } else {
+                if (index->hit > 0)
+                    index->hit--;
+                else if (TINYTERM_SEARCH_WRAP_AROUND)
+                    index->hit = index->hits->len - 1;
+            }
+            search_show_hit(index);
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* show the search bar for a pane and start indexing its history */
+static void
+search_open(TinyTerm* term)
+{
+    TinyTermWindow* win = term->win;
+
+    if (win->search_term != term) {
+        search_close(win);
+        if (!search_pool)
+            search_pool = g_thread_pool_new((GFunc) search_worker, NULL, 1, FALSE, NULL);
+        term->search = g_new0(SearchIndex, 1);
+        term->search->ref = 1;
+        term->search->term = term;
+        term->search->blocks = g_ptr_array_new_with_free_func((GDestroyNotify) search_block_unref);
+        term->search->indexed_row = gtk_adjustment_get_lower(term->vte->adjustment);
+        term->search->hits = g_array_new(FALSE, FALSE, sizeof(glong));
+        win->search_term = term;
+        gtk_widget_show(win->search);
+        search_changed_cb(GTK_EDITABLE (win->search), win);
+    }
+    gtk_widget_grab_focus(win->search);
+}
+
+/* stop the child of a pane and free it; its widgets are left to the caller */
+static void
+terminal_free(TinyTerm* term)
+{
+    g_signal_handlers_disconnect_matched(term->vte, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, term);
+    if (term->search)
+        search_close(term->win);
+    if (term->tmux && term == term->tmux->gateway)
+        tmux_free(term->tmux);
+    else if (term->tmux)
+        g_hash_table_remove(term->tmux->panes, GUINT_TO_POINTER (term->tmux_pane));
+    if (term->child_pid != 0) {
+        kill(term->child_pid, SIGHUP);
+        g_source_remove(term->child_watch);
+        g_child_watch_add(term->child_pid, child_reap_cb, NULL);
+    }
+    if (term->pty_read_watch)
+        g_source_remove(term->pty_read_watch);
+    if (term->pty_write_watch)
+        g_source_remove(term->pty_write_watch);
+    if (term->feed_source)
+        g_source_remove(term->feed_source);
+    if (term->title_source)
+        g_source_remove(term->title_source);
+    if (term->regex_source)
+        g_source_remove(term->regex_source);
+    if (term->font_source)
+        g_source_remove(term->font_source);
+    if (term->sync_source)
+        g_source_remove(term->sync_source);
+    if (term->pty_channel)
+        g_io_channel_unref(term->pty_channel);
+    if (term->log)
+        log_close(term->log);
+    if (term->pty)
+        g_object_unref(term->pty);
+    terminals = g_list_remove(terminals, term);
+    pool = g_list_remove(pool, term);
+    if (term->paste)
+        g_byte_array_free(term->paste, TRUE);
+    g_free(term->paste_title);
+    g_free(term->frame_times);
+    g_string_free(term->osc, TRUE);
+    g_free(term->link_uri);
+    if (term->link_wait_source)
+        g_source_remove(term->link_wait_source);
+    terminal_links_clear(term);
+    g_array_free(term->link_marks, TRUE);
+    while (!g_queue_is_empty(term->links))
+        hyperlink_free(g_queue_pop_head(term->links));
+    g_queue_free(term->links);
+    g_hash_table_destroy(term->url_rows);
+    if (term->predict)
+        g_string_free(term->predict, TRUE);
+    g_free(term->tmux_cursor);
+    if (term->restore)
+        session_restore_free(term->restore);
+    g_free(term->command);
+    g_byte_array_free(term->output, TRUE);
+    g_byte_array_free(term->input, TRUE);
+    if (term->tmux_state != TMUX_PANE_NONE)
+        g_object_unref(term->widget);   // taken by tmux_pane_get
+    g_free(term);
+}
+
+/* close a window with all its panes and report the exit status to its daemon client */
+static void
+window_close(TinyTermWindow* win, int status)
+{
+    GList* l;
+
+    for (l = win->panes; l; l = l->next)
+        terminal_free(l->data);
+    g_list_free(win->panes);
+    if (win->client) {
+        char* reply = g_strdup_printf("exit %d\n", status);
+        g_io_channel_write_chars(win->client, reply, -1, NULL, NULL);
+        g_io_channel_flush(win->client, NULL);
+        g_io_channel_unref(win->client);
+        g_free(reply);
+    }
+    g_signal_handlers_disconnect_matched(win->window, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, win);
+    gtk_widget_destroy(win->window);
+    g_strfreev(win->environment);
+    g_free(win);
+}
+
+/* put a widget in the place of another one, which is removed from its tab or split */
+static void
+widget_replace(GtkWidget* old, GtkWidget* widget)
+{
+    GtkWidget* parent = gtk_widget_get_parent(old);
+
+    if (GTK_IS_NOTEBOOK (parent)) {
+        GtkNotebook* notebook = GTK_NOTEBOOK (parent);
+        GtkWidget* label = g_object_ref(gtk_notebook_get_tab_label(notebook, old));
+        gint page = gtk_notebook_page_num(notebook, old);
+
+        gtk_notebook_remove_page(notebook, page);
+        gtk_notebook_insert_page(notebook, widget, label, page);
+        g_object_unref(label);
+        gtk_widget_show(widget);
+        gtk_notebook_set_current_page(notebook, page);
+    } else {
+        GtkPaned* paned = GTK_PANED (parent);
+        gboolean is_first = gtk_paned_get_child1(paned) == old;
+
+        gtk_container_remove(GTK_CONTAINER (paned), old);
+        if (is_first)
+            gtk_paned_pack1(paned, widget, TRUE, TRUE);
+        else
+            gtk_paned_pack2(paned, widget, TRUE, TRUE);
+    }
+}
+
+/* close a pane; its neighbour in a split takes its place, and its tab goes with the last pane in it */
+static void
+terminal_close(TinyTerm* term, int status)
+{
+    TinyTermWindow* win = term->win;
+    GtkWidget* parent = gtk_widget_get_parent(term->widget);
+    GtkWidget* widget;
+
+    if (!win->panes->next) {
+        window_close(win, status);
+        return;
+    }
+    win->panes = g_list_remove(win->panes, term);
+    if (win->current == term)
+        win->current = NULL;
+
+    /* the widgets of the pane have to outlive terminal_free, which disconnects from the vte */
+    g_object_ref(term->widget);
+    if (GTK_IS_PANED (parent)) {
+        GtkWidget* sibling = gtk_paned_get_child1(GTK_PANED (parent));
+        if (sibling == term->widget)
+            sibling = gtk_paned_get_child2(GTK_PANED (parent));
+        g_object_ref(sibling);
+        gtk_container_remove(GTK_CONTAINER (parent), sibling);
+        widget_replace(parent, sibling);    // destroys the split along with the pane
+        g_object_unref(sibling);
+    } else {
+        gtk_notebook_remove_page(GTK_NOTEBOOK (parent), gtk_notebook_page_num(GTK_NOTEBOOK (parent), term->widget));
+    }
+    widget = term->widget;
+    terminal_free(term);
+    g_object_unref(widget);
+
+    /* the focus was lost with the pane, give it to one in the same tab */
+    if (!gtk_window_get_focus(GTK_WINDOW (win->window)))
+        gtk_widget_child_focus(win->window, GTK_DIR_TAB_FORWARD);
+}
+
+/* write the terminal contents as HTML with the colors of the text */
+static gboolean
+terminal_dump_html(TinyTerm* term, GOutputStream* stream, GError** error)
+{
+    VteTerminal* vte = term->vte;
+    GArray* attributes = g_array_new(FALSE, FALSE, sizeof(VteCharAttributes));
+    char* text = vte_terminal_get_text_range(vte, gtk_adjustment_get_lower(vte->adjustment), 0,
+                                             gtk_adjustment_get_upper(vte->adjustment) - 1,
+                                             vte_terminal_get_column_count(vte) - 1, NULL, NULL, attributes);
+    GString* html = g_string_new(NULL);
+    const VteCharAttributes* last = NULL;
+    gboolean is_written;
+    guint i;
+
+    g_string_append_printf(html, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"></head>\n"
+                           "<body style=\"background-color:#%02x%02x%02x\"><pre>",
+                           config.background.red >> 8, config.background.green >> 8, config.background.blue >> 8);
+
+    /* vte gives the attributes of every byte of the text */
+    for (i = 0; text && text[i] && i < attributes->len; i++) {
+        const VteCharAttributes* attr = &g_array_index(attributes, VteCharAttributes, i);
+
+        if (!last || !gdk_color_equal(&attr->fore, &last->fore) || !gdk_color_equal(&attr->back, &last->back)
+                  || attr->underline != last->underline || attr->strikethrough != last->strikethrough) {
+            g_string_append_printf(html, "%s<span style=\"color:#%02x%02x%02x;background-color:#%02x%02x%02x%s%s%s\">",
+                                   last ? "</span>" : "",
+                                   attr->fore.red >> 8, attr->fore.green >> 8, attr->fore.blue >> 8,
+                                   attr->back.red >> 8, attr->back.green >> 8, attr->back.blue >> 8,
+                                   attr->underline || attr->strikethrough ? ";text-decoration:" : "",
+                                   attr->underline ? " underline" : "", attr->strikethrough ? " line-through" : "");
+            last = attr;
+        }
+        switch (text[i]) {
+            case '<':
+                g_string_append(html, "&lt;");
+                break;
+            case '>':
+                g_string_append(html, "&gt;");
+                break;
+            case '&':
+                g_string_append(html, "&amp;");
+                break;
+            default:
+                g_string_append_c(html, text[i]);
+        }
+    }
+    g_string_append_printf(html, "%s</pre></body></html>\n", last ? "</span>" : "");
+
+    is_written = g_output_stream_write_all(stream, html->str, html->len, NULL, NULL, error);
+    g_string_free(html, TRUE);
+    g_array_free(attributes, TRUE);
+    g_free(text);
+    return is_written;
+}
+
+/* write the scrollback and screen of a terminal to a file, as HTML if its name ends in .html */
+static gboolean
+terminal_dump(TinyTerm* term, const char* path)
+{
+    GError* error = NULL;
+    GFile* file = g_file_new_for_path(path);
+    GOutputStream* stream = G_OUTPUT_STREAM (g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error));
+
+    if (stream) {
+        if (g_str_has_suffix(path, ".html") || g_str_has_suffix(path, ".htm"))
+            terminal_dump_html(term, stream, &error);
+        else
+            vte_terminal_write_contents(term->vte, stream, VTE_TERMINAL_WRITE_DEFAULT, NULL, &error);
+        g_output_stream_close(stream, NULL, error ? NULL : &error);
+        g_object_unref(stream);
+    }
+    g_object_unref(file);
+    if (error) {
+        g_printerr("Failed to write %s: %s\n", path, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* callback to dump the terminal and exit once vte has processed all output (--headless) */
+static gboolean
+headless_dump_cb(TinyTerm* term)
+{
+    timing_mark("headless: output processed");
+    if (dump_path && !terminal_dump(term, dump_path))
+        exit(EXIT_FAILURE);
+    exit(headless_status);
+}
+
+/* callback to postpone the dump while vte is still processing output (--headless) */
+static void
+headless_settle_cb(VteTerminal* vte, TinyTerm* term)
+{
+    if (headless_source)
+        g_source_remove(headless_source);
+    headless_source = g_timeout_add(HEADLESS_SETTLE_TIME, (GSourceFunc) headless_dump_cb, term);
+}
+
+/* callback to close the pane of an exited child; TinyTerm exits with the status of the last one */
+static void
+child_exit_cb(GPid pid, gint status, TinyTerm* term)
+{
+    g_spawn_close_pid(pid);
+    status = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+    term->child_pid = 0;
+    term->child_watch = 0;
+
+    /* show what the child wrote before exiting */
+    while (term->pty_read_watch && pty_read(term) > 0)
+        ;
+    term->is_synchronized = FALSE;
+    terminal_feed(term);
+    if (term->tmux)
+        tmux_stop(term->tmux);
+    timing_mark("child exit");
+    if (show_timing)
+        g_printerr("timing: %u frames drawn\n", term->frames);
+    if (is_headless) {
+        headless_status = status;
+        g_signal_connect(term->vte, "contents-changed", G_CALLBACK (headless_settle_cb), term);
+        headless_settle_cb(term->vte, term);
+        return;
+    }
+    if (term->win->keep)
+        return;
+    if (!is_daemon && !terminals->next) {
+        gtk_main_quit();
+        exit(status);
+    }
+    terminal_close(term, status);
+}
+
+/* callback to close the window; the process keeps running if it is the daemon or has other windows */
+static gboolean
+window_delete_cb(GtkWidget* window, GdkEvent* event, TinyTermWindow* win)
+{
+    GList* l;
+
+    for (l = terminals; l && ((TinyTerm*) l->data)->win == win; l = l->next)
+        ;
+    if (!is_daemon && !l) {
+        gtk_main_quit();
+        return FALSE;
+    }
+    window_close(win, EXIT_SUCCESS);
+    return TRUE;
+}
+
+/* VTE spools scrollback to files in g_get_tmp_dir(); point it at TINYTERM_SCROLLBACK_DIR
+ * while leaving $TMPDIR of the children alone, GLib caches the first lookup */
+static void
+scrollback_dir_init(void)
+{
+    #ifdef TINYTERM_SCROLLBACK_DIR
+    char* tmpdir = g_strdup(g_getenv("TMPDIR"));
+    char* dir = g_build_filename(g_get_user_runtime_dir(), TINYTERM_SCROLLBACK_DIR, NULL);
+
+    if (g_mkdir_with_parents(dir, 0700) == 0) {
+        g_setenv("TMPDIR", dir, TRUE);
+        g_get_tmp_dir();
+        if (tmpdir)
+            g_setenv("TMPDIR", tmpdir, TRUE);
+        else
+            g_unsetenv("TMPDIR");
+    }
+    g_free(tmpdir);
+    g_free(dir);
+    #endif // TINYTERM_SCROLLBACK_DIR
+}
+
+/* bytes of the unlinked files vte keeps the history of all terminals of the process in */
+static guint64
+scrollback_file_bytes(void)
+{
+    GDir* dir = g_dir_open("/proc/self/fd", 0, NULL);
+    char* prefix = g_build_filename(g_get_tmp_dir(), "vte", NULL);  // vte opens them as vteXXXXXX
+    const char* name;
+    guint64 bytes = 0;
+
+    while (dir && (name = g_dir_read_name(dir))) {
+        char* path = g_build_filename("/proc/self/fd", name, NULL);
+        char* target = g_file_read_link(path, NULL);
+        struct stat st;
+        if (target && g_str_has_prefix(target, prefix) && !strchr(target + strlen(prefix), G_DIR_SEPARATOR)
+                && stat(path, &st) == 0 && S_ISREG (st.st_mode))
+            bytes += st.st_size;
+        g_free(target);
+        g_free(path);
+    }
+    if (dir)
+        g_dir_close(dir);
+    g_free(prefix);
+    return bytes;
+}
+
+/* share of the last 10 s some task stalled on memory in %, -1 without PSI */
+static gdouble
+memory_pressure(void)
+{
+    char line[256];
+    gdouble some = -1;
+    FILE* file = fopen("/proc/pressure/memory", "r");
+
+    if (file) {
+        if (!fgets(line, sizeof(line), file) || sscanf(line, "some avg10=%lf", &some) != 1)
+            some = -1;
+        fclose(file);
+    }
+    return some;
+}
+
+/* callback to halve the history of the terminal focused least recently whenever the
+ * scrollback of the process is over budget or memory is under pressure; vte doesn't shrink
+ * its files right away, so after a trim it waits for them to shrink before trimming again */
+static gboolean
+memory_check_cb(gpointer data)
+{
+    static guint64 trim_bytes = 0;  // scrollback measured at the last trim
+    static guint trim_checks = 0;   // checks since then, 0 if not waiting for a trim
+    TinyTerm* oldest = NULL;
+    glong oldest_rows = 0;
+    guint64 bytes = scrollback_file_bytes();
+    GList* l;
+
+    if ((TINYTERM_SCROLLBACK_BUDGET == 0 || bytes <= TINYTERM_SCROLLBACK_BUDGET)
+            && (TINYTERM_MEMORY_PRESSURE == 0 || memory_pressure() < TINYTERM_MEMORY_PRESSURE)) {
+        trim_checks = 0;
+        return TRUE;
+    }
+    if (trim_checks > 0 && bytes >= trim_bytes && trim_checks++ < SCROLLBACK_TRIM_WAIT)
+        return TRUE;
+
+    for (l = terminals; l; l = l->next) {
+        TinyTerm* term = l->data;
+        GtkAdjustment* adjustment = term->vte->adjustment;
+        glong rows = gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_lower(adjustment)
+                     - vte_terminal_get_row_count(term->vte);
+        if (term->has_focus || rows <= SCROLLBACK_TRIM_MIN)
+            continue;
+        if (!oldest || term->focus_time < oldest->focus_time) {
+            oldest = term;
+            oldest_rows = rows;
+        }
+    }
+    if (oldest) {
+        oldest->trimmed_lines = MAX(oldest_rows / 2, SCROLLBACK_TRIM_MIN);
+        vte_terminal_set_scrollback_lines(oldest->vte, oldest->trimmed_lines);
+        trim_bytes = bytes;
+        trim_checks = 1;
+    }
+    return TRUE;
+}
+
+/* callback to set the window icon supplied by an icon theme; the lookup can be slow
+ * on a cold cache, so it is done once per process when idle after the first frame,
+ * as the default icon of all windows */
+static gboolean
+window_icon_cb(gpointer data)
+{
+    GError* error = NULL;
+    GtkIconTheme* icon_theme = gtk_icon_theme_get_default();
+    GdkPixbuf* icon = gtk_icon_theme_load_icon(icon_theme, "terminal", 48, 0, &error);
+
+    if (icon) {
+        gtk_window_set_default_icon(icon);
+        g_object_unref(icon);
+    }
+    if (error)
+        g_error_free(error);
+    timing_mark("icon theme lookup");
+    return FALSE;
+}
+
+/* callback to schedule window_icon_cb once the first window is drawn */
+static gboolean
+window_icon_expose_cb(GtkWidget* widget, GdkEventExpose* event, gboolean* is_scheduled)
+{
+    g_signal_handlers_disconnect_matched(widget, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, is_scheduled);
+    g_idle_add_full(G_PRIORITY_LOW, window_icon_cb, NULL, NULL);
+    return FALSE;
+}
+
+/* create a pane of a window without a child; the pane is not packed yet */
+static TinyTerm*
+terminal_pane_create(TinyTermWindow* win)
+{
+    TinyTerm* term = g_new0(TinyTerm, 1);
+
+    term->win = win;
+    term->session_id = ++session_last_id;
+    term->is_mapped = gtk_widget_get_mapped(win->window);
+    term->output = g_byte_array_new();
+    term->input = g_byte_array_new();
+
+    /* Create a box for the vte and its scrollbar */
+    term->widget = gtk_hbox_new(FALSE, 0);
+
+    /* Create vte terminal widget */
+    GtkWidget* vte_widget = vte_terminal_new();
+    timing_mark("vte_terminal_new");
+    gtk_box_pack_start(GTK_BOX (term->widget), vte_widget, TRUE, TRUE, 0);
+    VteTerminal* vte = VTE_TERMINAL (vte_widget);
+    term->vte = vte;
+    gtk_widget_add_events(vte_widget, GDK_VISIBILITY_NOTIFY_MASK);
+    g_signal_connect(vte, "visibility-notify-event", G_CALLBACK (terminal_state_cb), term);
+    g_signal_connect(vte, "focus-in-event",  G_CALLBACK (terminal_state_cb), term);
+    g_signal_connect(vte, "focus-out-event", G_CALLBACK (terminal_state_cb), term);
+    g_signal_connect(vte, "focus-in-event",  G_CALLBACK (terminal_focus_cb), term);
+    g_signal_connect_after(vte, "map", G_CALLBACK (vte_map_cb), term);
+    g_signal_connect(vte, "commit", G_CALLBACK (vte_commit_cb), term);
+    g_signal_connect_after(vte, "size-allocate", G_CALLBACK (vte_size_cb), term);
+    g_signal_connect(vte, "key-press-event", G_CALLBACK (key_press_cb), term);
+    g_signal_connect(vte, "contents-changed", G_CALLBACK (vte_contents_cb), term);
+    g_signal_connect_after(vte, "contents-changed", G_CALLBACK (vte_processed_cb), term);
+    g_signal_connect_after(vte, "cursor-moved", G_CALLBACK (vte_processed_cb), term);
+    g_signal_connect_after(vte, "motion-notify-event", G_CALLBACK (vte_motion_cb), term);
+    g_signal_connect(vte, "button-press-event", G_CALLBACK (vte_button_cb), term);
+    g_signal_connect(vte, "expose-event", G_CALLBACK (vte_frame_start_cb), term);
+    g_signal_connect_after(vte, "expose-event", G_CALLBACK (vte_frame_end_cb), term);
+    g_signal_connect(vte, "window-title-changed", G_CALLBACK (vte_title_count_cb), term);
+    g_signal_connect(vte, "beep", G_CALLBACK (vte_bell_cb), term);
+    #ifdef TINYTERM_URGENT_ON_BELL
+    g_signal_connect(vte, "beep", G_CALLBACK (window_urgency_hint_cb), NULL);
+    #endif // TINYTERM_URGENT_ON_BELL
+    #ifdef TINYTERM_DYNAMIC_WINDOW_TITLE
+    if (!win->has_title)
+        term->title_handler = g_signal_connect(vte, "window-title-changed", G_CALLBACK (window_title_cb), term);
+    #endif // TINYTERM_DYNAMIC_WINDOW_TITLE
+
+    vte_config(vte);
+    term->font_size = initial_font_size;
+    g_signal_connect_after(vte, "expose-event", G_CALLBACK (vte_regex_expose_cb), term);
+
+    /* Create scrollbar */
+    #ifdef TINYTERM_SCROLLBAR_VISIBLE
+    GtkWidget* scrollbar;
+    scrollbar = gtk_vscrollbar_new(vte->adjustment);
+    gtk_widget_set_can_focus(scrollbar, FALSE);
+    gtk_box_pack_start(GTK_BOX (term->widget), scrollbar, FALSE, FALSE, 0);
+    #endif // TINYTERM_SCROLLBAR_VISIBLE
+
+    term->osc = g_string_new(NULL);
+    term->links = g_queue_new();
+    term->link_marks = g_array_new(FALSE, FALSE, sizeof(LinkMark));
+    term->link_offset = G_MAXSIZE;
+    term->url_rows = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) url_row_free);
+    term->hover_row = -1;
+    if (win->predict)
+        term->predict = g_string_new(NULL);
+    return term;
+}
+
+/* create a pane of a window and spawn its child, NULL on failure; the pane is not packed yet */
+static TinyTerm*
+terminal_pane_new(TinyTermWindow* win, char* directory, char* command)
+{
+    TinyTerm* term = terminal_pane_create(win);
+
+    if (!vte_spawn(term, directory, command, win->environment)) {
+        GtkWidget* widget = g_object_ref_sink(term->widget);
+        terminal_free(term);
+        gtk_widget_destroy(widget);
+        g_object_unref(widget);
+        return NULL;
+    }
+    term->command = g_strdup(command);
+    terminals = g_list_prepend(terminals, term);
+    win->panes = g_list_append(win->panes, term);
+    return term;
+}
+
+/* callback to show the tabs only if there is more than one */
+static void
+notebook_pages_cb(GtkNotebook* notebook, GtkWidget* child, guint page, gpointer data)
+{
+    gtk_notebook_set_show_tabs(notebook, gtk_notebook_get_n_pages(notebook) > 1);
+}
+
+/* create a window without panes and without showing it */
+static TinyTermWindow*
+window_new(const TinyTermOptions* options)
+{
+    TinyTermWindow* win = g_new0(TinyTermWindow, 1);
+    GtkWidget* box;
+
+    win->keep = options->keep;
+    win->predict = options->predict;
+    win->has_title = options->title != NULL;
+    win->environment = g_strdupv(options->environment);
+
+    /* Create window */
+    win->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    g_signal_connect(win->window, "delete-event", G_CALLBACK (window_delete_cb), win);
+    g_signal_connect(win->window, "map-event",    G_CALLBACK (window_state_cb), win);
+    g_signal_connect(win->window, "unmap-event",  G_CALLBACK (window_state_cb), win);
+    #ifdef TINYTERM_URGENT_ON_BELL
+    g_signal_connect(win->window, "focus-in-event",  G_CALLBACK (window_focus_cb), NULL);
+    g_signal_connect(win->window, "focus-out-event", G_CALLBACK (window_focus_cb), NULL);
+    #endif // TINYTERM_URGENT_ON_BELL
+    gtk_window_set_wmclass(GTK_WINDOW (win->window), options->name ? options->name : "tinyterm", "TinyTerm");
+    gtk_window_set_title(GTK_WINDOW (win->window), options->title ? options->title : "TinyTerm");
+    if (options->startup_id)
+        gtk_window_set_startup_id(GTK_WINDOW (win->window), options->startup_id);
+
+    /* Create notebook for the tabs, they are only shown with more than one */
+    win->notebook = gtk_notebook_new();
+    gtk_notebook_set_show_tabs(GTK_NOTEBOOK (win->notebook), FALSE);
+    gtk_notebook_set_show_border(GTK_NOTEBOOK (win->notebook), FALSE);
+    gtk_notebook_set_scrollable(GTK_NOTEBOOK (win->notebook), TRUE);
+    gtk_widget_set_can_focus(win->notebook, FALSE);
+    g_signal_connect(win->notebook, "page-added",   G_CALLBACK (notebook_pages_cb), NULL);
+    g_signal_connect(win->notebook, "page-removed", G_CALLBACK (notebook_pages_cb), NULL);
+    box = gtk_vbox_new(FALSE, 0);
+    gtk_container_add(GTK_CONTAINER (win->window), box);
+    gtk_box_pack_start(GTK_BOX (box), win->notebook, TRUE, TRUE, 0);
+
+    /* Create search bar, shown by search_open */
+    win->search = gtk_entry_new();
+    gtk_widget_set_no_show_all(win->search, TRUE);
+    g_signal_connect(win->search, "changed", G_CALLBACK (search_changed_cb), win);
+    g_signal_connect(win->search, "key-press-event", G_CALLBACK (search_key_cb), win);
+    gtk_box_pack_start(GTK_BOX (box), win->search, FALSE, FALSE, 0);
+    return win;
+}
+
+/* free a window none of whose panes was added */
+static void
+window_free(TinyTermWindow* win)
+{
+    gtk_widget_destroy(win->window);
+    g_strfreev(win->environment);
+    g_free(win);
+}
+
+/* add the first pane to a window */
+static void
+window_add_pane(TinyTermWindow* win, TinyTerm* term)
+{
+    gtk_notebook_append_page(GTK_NOTEBOOK (win->notebook), term->widget,
+                             gtk_label_new(gtk_window_get_title(GTK_WINDOW (win->window))));
+    win->current = term;
+    set_geometry_hints(term->vte);
+    timing_mark("set_geometry_hints");
+}
+
+/* create a terminal window and spawn its child without showing it, NULL on failure */
+static TinyTerm*
+terminal_new(const TinyTermOptions* options)
+{
+    TinyTermWindow* win = window_new(options);
+    TinyTerm* term;
+    PtyLog* log = NULL;
+
+    if (options->log && !(log = log_open(options->log))) {
+        window_free(win);
+        return NULL;
+    }
+    term = terminal_pane_new(win, options->directory, options->command);
+    if (!term) {
+        if (log)
+            log_close(log);
+        window_free(win);
+        return NULL;
+    }
+    window_add_pane(win, term);
+    term->log = log;
+    return term;
+}
+
+/* working directory of the child of a pane, NULL if unknown */
+static char*
+terminal_get_directory(TinyTerm* term)
+{
+    char* link = g_strdup_printf("/proc/%d/cwd", (int) term->child_pid);
+    char* directory = term->child_pid != 0 ? g_file_read_link(link, NULL) : NULL;
+
+    g_free(link);
+    return directory;
+}
+
+/* put a new pane in a tab after the one of another pane */
+static void
+terminal_tab_add(TinyTerm* term, TinyTerm* pane)
+{
+    GtkNotebook* notebook = GTK_NOTEBOOK (term->win->notebook);
+    gint page = gtk_notebook_insert_page(notebook, pane->widget, gtk_label_new(gtk_window_get_title(GTK_WINDOW (term->win->window))),
+                                         gtk_notebook_page_num(notebook, terminal_page(term)) + 1);
+
+    gtk_widget_show_all(pane->widget);
+    gtk_notebook_set_current_page(notebook, page);
+    gtk_widget_grab_focus(GTK_WIDGET (pane->vte));
+}
+
+/* open a tab after the one of a pane, in the working directory of its child */
+static void
+terminal_tab_new(TinyTerm* term)
+{
+    char* directory;
+    TinyTerm* pane;
+
+    /* tmux opens the window and reports it, see tmux_line */
+    if (term->tmux_state != TMUX_PANE_NONE && term->tmux) {
+        tmux_command(term->tmux, TMUX_REPLY_IGNORE, 0, "new-window -a -t %%%u", term->tmux_pane);
+        return;
+    }
+    directory = terminal_get_directory(term);
+    pane = terminal_pane_new(term->win, directory, NULL);
+    g_free(directory);
+    if (pane)
+        terminal_tab_add(term, pane);
+}
+
+/* put a new pane to the right of or below another one */
+static void
+terminal_split_add(TinyTerm* term, TinyTerm* pane, gboolean is_vertical)
+{
+    GtkWidget* paned = is_vertical ? gtk_vpaned_new() : gtk_hpaned_new();
+
+    g_object_ref(term->widget);
+    widget_replace(term->widget, paned);
+    gtk_paned_pack1(GTK_PANED (paned), term->widget, TRUE, TRUE);
+    gtk_paned_pack2(GTK_PANED (paned), pane->widget, TRUE, TRUE);
+    g_object_unref(term->widget);
+    gtk_widget_show_all(paned);
+    gtk_widget_grab_focus(GTK_WIDGET (pane->vte));
+}
+
+/* split a pane in two, the new pane goes to the right or below */
+static void
+terminal_split(TinyTerm* term, gboolean is_vertical)
+{
+    char* directory;
+    TinyTerm* pane;
+
+    if (term->tmux_state != TMUX_PANE_NONE && term->tmux) {
+        tmux_command(term->tmux, TMUX_REPLY_IGNORE, 0, "split-window %s -t %%%u", is_vertical ? "-v" : "-h", term->tmux_pane);
+        return;
+    }
+    directory = terminal_get_directory(term);
+    pane = terminal_pane_new(term->win, directory, NULL);
+    g_free(directory);
+    if (pane)
+        terminal_split_add(term, pane, is_vertical);
+}
+
+/* move the focus to the next pane in the same tab */
+static void
+terminal_focus_next(TinyTerm* term)
+{
+    GtkWidget* page = terminal_page(term);
+    GList* l = g_list_find(term->win->panes, term);
+
+    do
+        l = l->next ? l->next : term->win->panes;
+    while (terminal_page(l->data) != page);
+    gtk_widget_grab_focus(GTK_WIDGET (((TinyTerm*) l->data)->vte));
+}
+
+/* a command sent to tmux, answered in the order they were sent */
+typedef struct {
+    guint reply;            // TMUX_REPLY_*
+    guint pane;             // tmux pane the reply is about, if any
+} TmuxCommand;
+
+/* send a command to tmux through the pty of the pane running it */
+static void
+tmux_command(TmuxClient* tmux, guint reply, guint pane, const char* format, ...)
+{
+    TmuxCommand* command = g_new(TmuxCommand, 1);
+    va_list args;
+    char* line;
+
+    va_start(args, format);
+    line = g_strdup_vprintf(format, args);
+    va_end(args);
+    command->reply = reply;
+    command->pane = pane;
+    g_queue_push_tail(tmux->commands, command);
+    g_byte_array_append(tmux->gateway->input, (guint8*) line, strlen(line));
+    g_byte_array_append(tmux->gateway->input, (guint8*) "\n", 1);
+    pty_write(tmux->gateway);
+    g_free(line);
+}
+
+/* send input to a tmux pane as hex keys; in the pane running tmux only q does something, it detaches */
+static void
+tmux_input(TinyTerm* term, const char* data, gsize len)
+{
+    GString* command;
+    gsize i;
+
+    if (term == term->tmux->gateway) {
+        if (len == 1 && *data == 'q')
+            tmux_command(term->tmux, TMUX_REPLY_IGNORE, 0, "detach-client");
+        return;
+    }
+    command = g_string_new(NULL);
+    for (i = 0; i < len; i++) {
+        if (i % TMUX_KEYS_MAX == 0)
+            g_string_printf(command, "send-keys -t %%%u -H", term->tmux_pane);
+        g_string_append_printf(command, " %02x", (guchar) data[i]);
+        if (i % TMUX_KEYS_MAX == TMUX_KEYS_MAX - 1 || i == len - 1)
+            tmux_command(term->tmux, TMUX_REPLY_IGNORE, 0, "%s", command->str);
+    }
+    g_string_free(command, TRUE);
+}
+
+/* tell tmux the size of a tab in cells, which it lays out the panes of its windows in */
+static void
+tmux_resize(TmuxClient* tmux)
+{
+    glong columns = vte_terminal_get_column_count(tmux->gateway->vte);
+    glong rows = vte_terminal_get_row_count(tmux->gateway->vte);
+
+    if (columns == tmux->columns && rows == tmux->rows)
+        return;
+    tmux->columns = columns;
+    tmux->rows = rows;
+    tmux_command(tmux, TMUX_REPLY_IGNORE, 0, "refresh-client -C %ld,%ld", columns, rows);
+}
+
+/* fetch the contents and history of a tmux pane that is shown for the first time; its output
+ * up to the reply is part of them and dropped, see tmux_pane_output */
+static void
+tmux_capture(TinyTerm* term)
+{
+    char* history = config.scrollback_lines < 0 ? g_strdup("-") : g_strdup_printf("-%ld", config.scrollback_lines);
+
+    term->tmux_state = TMUX_PANE_CAPTURING;
+    tmux_command(term->tmux, TMUX_REPLY_CURSOR, term->tmux_pane,
+                 "display-message -p -t %%%u '#{cursor_x} #{cursor_y} #{alternate_on} #{cursor_flag}'", term->tmux_pane);
+    tmux_command(term->tmux, TMUX_REPLY_CAPTURE, term->tmux_pane,
+                 "capture-pane -p -e -J -t %%%u -S %s", term->tmux_pane, history);
+    g_free(history);
+}
+
+/* pass output of a tmux pane on to its vte, like the output of a child */
+static void
+tmux_pane_output(TinyTerm* term, const char* data, gsize len)
+{
+    if (term->tmux_state != TMUX_PANE_LIVE)
+        return;
+    term->has_output = TRUE;
+    term->bytes_read += len;
+    pty_scan(term, data, len);
+    if (term->log)
+        log_append(term->log, data, len);
+    g_byte_array_append(term->output, (guint8*) data, len);
+    terminal_feed_schedule(term);
+}
+
+/* show the captured contents of a tmux pane, after which its output is fed as it comes */
+static void
+tmux_pane_restore(TinyTerm* term, const char* contents)
+{
+    GString* output = g_string_new(NULL);
+    guint x = 0, y = 0, is_alternate = 0, has_cursor = 1;
+    const char* p;
+
+    if (term->tmux_cursor)
+        sscanf(term->tmux_cursor, "%u %u %u %u", &x, &y, &is_alternate, &has_cursor);
+    if (is_alternate)
+        g_string_append(output, "\033[?1049h");
+    /* the last line is not ended, that would scroll the first one out */
+    for (p = contents; *p; p++) {
+        if (*p != '\n')
+            g_string_append_c(output, *p);
+        else if (p[1])
+            g_string_append(output, "\r\n");
+    }
+    g_string_append_printf(output, "\033[0m\033[%u;%uH%s", y + 1, x + 1, has_cursor ? "" : "\033[?25l");
+
+    vte_terminal_reset(term->vte, TRUE, TRUE);
+    g_byte_array_set_size(term->output, 0);
+    terminal_links_clear(term);
+    term->tmux_state = TMUX_PANE_LIVE;
+    tmux_pane_output(term, output->str, output->len);
+    g_string_free(output, TRUE);
+    g_free(term->tmux_cursor);
+    term->tmux_cursor = NULL;
+}
+
+/* the pane showing a tmux pane, created the first time the tmux pane is in a layout */
+static TinyTerm*
+tmux_pane_get(TmuxClient* tmux, guint id, guint window)
+{
+    TinyTerm* term = g_hash_table_lookup(tmux->panes, GUINT_TO_POINTER (id));
+    GtkWidget* parent;
+
+    if (!term) {
+        term = terminal_pane_create(tmux->gateway->win);
+        g_object_ref_sink(term->widget);    // kept while the layout changes, released by terminal_free
+        term->tmux = tmux;
+        term->tmux_pane = id;
+        term->tmux_state = TMUX_PANE_NEW;
+        g_hash_table_insert(tmux->panes, GUINT_TO_POINTER (id), term);
+        terminals = g_list_prepend(terminals, term);
+        term->win->panes = g_list_append(term->win->panes, term);
+    }
+    /* a pane moved from another window */
+    if ((parent = gtk_widget_get_parent(term->widget)))
+        gtk_container_remove(GTK_CONTAINER (parent), term->widget);
+    term->tmux_window = window;
+    return term;
+}
+
+/* build the widgets of a cell of a tmux layout, which is a pane, like 80x24,0,0,1,
+ * or a row or column of cells, like 80x24,0,0{40x24,0,0,1,39x24,41,0,2}; NULL if malformed */
+static GtkWidget*
+tmux_layout_parse(TmuxClient* tmux, guint window, const char** layout, guint* columns, guint* rows)
+{
+    GtkWidget* widget = NULL;
+    guint x, y;
+    gint n = 0;
+    char* end;
+
+    if (sscanf(*layout, "%ux%u,%u,%u%n", columns, rows, &x, &y, &n) != 4 || n == 0)
+        return NULL;
+    *layout += n;
+    if (**layout == ',') {
+        guint id = strtoul(*layout + 1, &end, 10);
+        *layout = end;
+        return tmux_pane_get(tmux, id, window)->widget;
+    }
+    if (**layout == '{' || **layout == '[') {
+        gboolean is_vertical = **layout == '[';
+        glong char_size = is_vertical ? vte_terminal_get_char_height(tmux->gateway->vte)
+                                      : vte_terminal_get_char_width(tmux->gateway->vte);
+        guint offset = 0;
+        guint cell_columns, cell_rows;
+        GtkWidget* cell;
+
+        /* the cells are split off one by one, tmux puts a border of one cell between them */
+        do {
+            (*layout)++;
+            if (!(cell = tmux_layout_parse(tmux, window, layout, &cell_columns, &cell_rows)))
+                break;
+            if (widget) {
+                GtkWidget* paned = is_vertical ? gtk_vpaned_new() : gtk_hpaned_new();
+                gtk_paned_pack1(GTK_PANED (paned), widget, TRUE, TRUE);
+                gtk_paned_pack2(GTK_PANED (paned), cell, TRUE, TRUE);
+                gtk_paned_set_position(GTK_PANED (paned), (offset - 1) * char_size);
+                widget = paned;
+            } else {
+                widget = cell;
+            }
+            offset += (is_vertical ? cell_rows : cell_columns) + 1;
+        } while (**layout == ',');
+        if (**layout == (is_vertical ? ']' : '}'))
+            (*layout)++;
+    }
+    return widget;
+}
+
+/* take the panes of a tmux window out of its tab and remove the tab; returns its position or -1 */
+static gint
+tmux_window_detach(TmuxClient* tmux, guint window, char** name)
+{
+    GtkNotebook* notebook = GTK_NOTEBOOK (tmux->gateway->win->notebook);
+    GtkWidget* page = g_hash_table_lookup(tmux->windows, GUINT_TO_POINTER (window));
+    GList* panes = g_hash_table_get_values(tmux->panes);
+    gint position = page ? gtk_notebook_page_num(notebook, page) : -1;
+    GList* l;
+
+    if (name)
+        *name = page ? g_strdup(gtk_notebook_get_tab_label_text(notebook, page)) : NULL;
+    for (l = panes; l; l = l->next) {
+        TinyTerm* term = l->data;
+        GtkWidget* parent = gtk_widget_get_parent(term->widget);
+
+        if (term->tmux_window != window)
+            continue;
+        if (parent)
+            gtk_container_remove(GTK_CONTAINER (parent), term->widget);
+        term->tmux_window = TMUX_WINDOW_NONE;
+    }
+    /* the splits left over, unless the pane was the page itself */
+    if (page && gtk_notebook_page_num(notebook, page) >= 0)
+        gtk_notebook_remove_page(notebook, gtk_notebook_page_num(notebook, page));
+    g_hash_table_remove(tmux->windows, GUINT_TO_POINTER (window));
+    g_list_free(panes);
+    return position;
+}
+
+/* close the panes no longer in the layout of a tmux window */
+static void
+tmux_panes_close(TmuxClient* tmux)
+{
+    GList* panes = g_hash_table_get_values(tmux->panes);
+    GList* l;
+
+    for (l = panes; l; l = l->next) {
+        TinyTerm* term = l->data;
+        if (term->tmux_window != TMUX_WINDOW_NONE)
+            continue;
+        term->win->panes = g_list_remove(term->win->panes, term);
+        if (term->win->current == term)
+            term->win->current = NULL;
+        terminal_free(term);
+    }
+    g_list_free(panes);
+    if (!gtk_window_get_focus(GTK_WINDOW (tmux->gateway->win->window)))
+        gtk_widget_child_focus(tmux->gateway->win->window, GTK_DIR_TAB_FORWARD);
+}
+
+/* show a tmux window in a tab with the panes of its layout, replacing the tab it had */
+static void
+tmux_window_update(TmuxClient* tmux, guint window, const char* layout, const char* name)
+{
+    GtkNotebook* notebook = GTK_NOTEBOOK (tmux->gateway->win->notebook);
+    GtkWidget* page = g_hash_table_lookup(tmux->windows, GUINT_TO_POINTER (window));
+    gboolean is_current = page && gtk_notebook_page_num(notebook, page) == gtk_notebook_get_current_page(notebook);
+    char* old_name = NULL;
+    guint columns, rows;
+    gint position;
+
+    position = tmux_window_detach(tmux, window, &old_name);
+    page = tmux_layout_parse(tmux, window, &layout, &columns, &rows);
+    if (page) {
+        position = gtk_notebook_insert_page(notebook, page, gtk_label_new(name ? name : old_name), position);
+        g_hash_table_insert(tmux->windows, GUINT_TO_POINTER (window), page);
+        gtk_widget_show_all(page);
+        if (is_current)
+            gtk_notebook_set_current_page(notebook, position);
+    }
+    tmux_panes_close(tmux);
+    g_free(old_name);
+}
+
+/* remove the tabs of all tmux windows */
+static void
+tmux_windows_close(TmuxClient* tmux)
+{
+    GList* windows = g_hash_table_get_keys(tmux->windows);
+    GList* l;
+
+    for (l = windows; l; l = l->next)
+        tmux_window_detach(tmux, GPOINTER_TO_UINT (l->data), NULL);
+    g_list_free(windows);
+    tmux_panes_close(tmux);
+}
+
+/* ask tmux for the windows of the session, the ones without a tab get one */
+static void
+tmux_windows_list(TmuxClient* tmux)
+{
+    tmux_command(tmux, TMUX_REPLY_WINDOWS, 0, "list-windows -F '#{window_id} #{window_layout} #{window_name}'");
+}
+
+/* handle the reply to a command, one line of output per line */
+static void
+tmux_reply(TmuxClient* tmux, TmuxCommand* command, char* reply, gboolean is_error)
+{
+    TinyTerm* term = g_hash_table_lookup(tmux->panes, GUINT_TO_POINTER (command->pane));
+    char** lines;
+    guint i;
+
+    switch (command->reply) {
+        case TMUX_REPLY_WINDOWS:
+            lines = g_strsplit(is_error ? "" : reply, "\n", -1);
+            for (i = 0; lines[i]; i++) {
+                char** fields = g_strsplit(lines[i], " ", 3);
+                guint window = fields[0] && fields[0][0] == '@' ? strtoul(fields[0] + 1, NULL, 10) : TMUX_WINDOW_NONE;
+                if (window != TMUX_WINDOW_NONE && fields[1] && !g_hash_table_lookup(tmux->windows, GUINT_TO_POINTER (window)))
+                    tmux_window_update(tmux, window, fields[1], fields[2] ? fields[2] : "");
+                g_strfreev(fields);
+            }
+            g_strfreev(lines);
+            break;
+        case TMUX_REPLY_CURSOR:
+            if (term && !is_error) {
+                g_free(term->tmux_cursor);
+                term->tmux_cursor = g_strdup(reply);
+            }
+            break;
+        case TMUX_REPLY_CAPTURE:
+            if (term)
+                tmux_pane_restore(term, is_error ? "" : reply);
+            break;
+    }
+}
+
+/* decode the octal escapes of %output in place, returns the decoded length */
+static gsize
+tmux_unescape(char* data)
+{
+    char* out = data;
+    char* p;
+
+    for (p = data; *p; p++) {
+        if (p[0] == '\\' && p[1] >= '0' && p[1] <= '7' && p[2] >= '0' && p[2] <= '7' && p[3] >= '0' && p[3] <= '7') {
+            *out++ = (p[1] - '0') << 6 | (p[2] - '0') << 3 | (p[3] - '0');
+            p += 3;
+        } else {
+            *out++ = *p;
+        }
+    }
+    return out - data;
+}
+
+/* handle a line of tmux, a notification or part of a reply; FALSE once tmux exited */
+static gboolean
+tmux_line(TmuxClient* tmux, char* line)
+{
+    char** fields;
+    guint window;
+
+    if (tmux->reply) {
+        if (g_str_has_prefix(line, "%end ") || g_str_has_prefix(line, "%error ")) {
+            TmuxCommand* command = tmux->is_own_reply ? g_queue_pop_head(tmux->commands) : NULL;
+            if (command)
+                tmux_reply(tmux, command, tmux->reply->str, line[1] == 'e' && line[2] == 'r');
+            g_free(command);
+            g_string_free(tmux->reply, TRUE);
+            tmux->reply = NULL;
+        } else {
+            g_string_append(tmux->reply, line);
+            g_string_append_c(tmux->reply, '\n');
+        }
+        return TRUE;
+    }
+    if (g_str_has_prefix(line, "%output %")) {
+        char* data;
+        guint id = strtoul(line + 9, &data, 10);
+        TinyTerm* term = g_hash_table_lookup(tmux->panes, GUINT_TO_POINTER (id));
+        if (term && *data == ' ')
+            tmux_pane_output(term, data + 1, tmux_unescape(data + 1));
+        return TRUE;
+    }
+    if (g_str_has_prefix(line, "%begin ")) {
+        guint flags = 0;
+        /* %begin time number flags; the flags tell the replies to our commands from others */
+        sscanf(line, "%%begin %*s %*s %u", &flags);
+        tmux->reply = g_string_new(NULL);
+        tmux->is_own_reply = flags & 1;
+        return TRUE;
+    }
+    if (g_str_has_prefix(line, "%exit")) {
+        tmux_stop(tmux);
+        return FALSE;
+    }
+
+    /* notifications about windows: %name @window [arguments] */
+    fields = g_strsplit(line, " ", 3);
+    window = fields[0] && fields[1] && fields[1][0] == '@' ? strtoul(fields[1] + 1, NULL, 10) : TMUX_WINDOW_NONE;
+    if (window == TMUX_WINDOW_NONE) {
+        if (fields[0] && !strcmp(fields[0], "%session-changed")) {
+            tmux_windows_close(tmux);
+            tmux_windows_list(tmux);
+        }
+    } else if (!strcmp(fields[0], "%layout-change") && fields[2]) {
+        char* space = strchr(fields[2], ' ');
+        if (space)
+            *space = '\0';
+        if (g_hash_table_lookup(tmux->windows, GUINT_TO_POINTER (window)))
+            tmux_window_update(tmux, window, fields[2], NULL);
+    } else if (!strcmp(fields[0], "%window-add")) {
+        tmux_windows_list(tmux);
+    } else if (!strcmp(fields[0], "%window-close") || !strcmp(fields[0], "%unlinked-window-close")) {
+        tmux_window_detach(tmux, window, NULL);
+        tmux_panes_close(tmux);
+    } else if (!strcmp(fields[0], "%window-renamed") && fields[2]) {
+        GtkWidget* page = g_hash_table_lookup(tmux->windows, GUINT_TO_POINTER (window));
+        if (page)
+            gtk_notebook_set_tab_label_text(GTK_NOTEBOOK (tmux->gateway->win->notebook), page, fields[2]);
+    }
+    g_strfreev(fields);
+    return TRUE;
+}
+
+/* handle output of tmux -CC, returns the bytes read up to the end of control mode */
+static gsize
+tmux_read(TmuxClient* tmux, const char* data, gsize len)
+{
+    const char* end = data + len;
+    const char* p = data;
+
+    while (p < end) {
+        const char* newline = memchr(p, '\n', end - p);
+
+        if (!newline) {
+            g_string_append_len(tmux->line, p, end - p);
+            break;
+        }
+        g_string_append_len(tmux->line, p, newline - p);
+        if (tmux->line->len > 0 && tmux->line->str[tmux->line->len - 1] == '\r')
+            g_string_truncate(tmux->line, tmux->line->len - 1);
+        p = newline + 1;
+        if (!tmux_line(tmux, tmux->line->str))
+            return p - data;
+        g_string_truncate(tmux->line, 0);
+    }
+    return len;
+}
+
+/* the child of a pane switched to tmux control mode */
+static void
+tmux_start(TinyTerm* term)
+{
+    TmuxClient* tmux = g_new0(TmuxClient, 1);
+
+    tmux->gateway = term;
+    tmux->line = g_string_new(NULL);
+    tmux->commands = g_queue_new();
+    tmux->panes = g_hash_table_new(NULL, NULL);
+    tmux->windows = g_hash_table_new(NULL, NULL);
+    term->tmux = tmux;
+    tmux_resize(tmux);
+    tmux_windows_list(tmux);
+}
+
+/* free a tmux client; panes still showing its tmux panes keep their contents */
+static void
+tmux_free(TmuxClient* tmux)
+{
+    GList* panes = g_hash_table_get_values(tmux->panes);
+    GList* l;
+
+    for (l = panes; l; l = l->next)
+        ((TinyTerm*) l->data)->tmux = NULL;
+    g_list_free(panes);
+    while (!g_queue_is_empty(tmux->commands))
+        g_free(g_queue_pop_head(tmux->commands));
+    g_queue_free(tmux->commands);
+    g_hash_table_destroy(tmux->panes);
+    g_hash_table_destroy(tmux->windows);
+    g_string_free(tmux->line, TRUE);
+    if (tmux->reply)
+        g_string_free(tmux->reply, TRUE);
+    tmux->gateway->tmux = NULL;
+    g_free(tmux);
+}
+
+/* end control mode once tmux detached or exited, closing the tabs of its windows */
+static void
+tmux_stop(TmuxClient* tmux)
+{
+    TinyTerm* gateway = tmux->gateway;
+
+    tmux_windows_close(tmux);
+    tmux_free(tmux);
+    gtk_notebook_set_current_page(GTK_NOTEBOOK (gateway->win->notebook),
+                                  gtk_notebook_page_num(GTK_NOTEBOOK (gateway->win->notebook), terminal_page(gateway)));
+    gtk_widget_grab_focus(GTK_WIDGET (gateway->vte));
+}
+
+/* map the window of a terminal */
+static void
+terminal_show(TinyTerm* term)
+{
+    static gboolean is_icon_scheduled = FALSE;
+
+    if (!is_icon_scheduled) {
+        g_signal_connect_after(term->vte, "expose-event", G_CALLBACK (window_icon_expose_cb), &is_icon_scheduled);
+        is_icon_scheduled = TRUE;
+    }
+    if (show_timing) {
+        g_signal_connect(term->win->window, "map-event", G_CALLBACK (timing_event_cb), "first map-event");
+        g_signal_connect_after(term->vte, "expose-event", G_CALLBACK (timing_event_cb), "first frame drawn");
+    }
+    gtk_widget_show_all(term->win->window);
+    timing_mark("gtk_widget_show_all");
+}
+
+/* panes of a --layout file or a session snapshot, one per group, whose children are spawned
+ * before the windows are built */
+typedef struct {
+    GKeyFile* file;
+    char** groups;
+    gsize count;
+    VtePty** ptys;          // NULL for a pane whose child failed to spawn
+    GPid* pids;
+    TinyTerm** terms;       // panes built by layout_open, NULL for the ones that failed
+} Layout;
+
+/* a string of a pane of a layout, NULL if not set */
+static char*
+layout_get_string(Layout* layout, gsize pane, const char* key)
+{
+    return g_key_file_get_string(layout->file, layout->groups[pane], key, NULL);
+}
+
+/* a file name of a pane of a layout with ~ expanded, NULL if not set */
+static char*
+layout_get_path(Layout* layout, gsize pane, const char* key)
+{
+    char* path = layout_get_string(layout, pane, key);
+    char* expanded;
+
+    if (!path || path[0] != '~')
+        return path;
+    expanded = g_build_filename(g_get_home_dir(), path + 1, NULL);
+    g_free(path);
+    return expanded;
+}
+
+/* spawn the children of all panes of a layout at once, so they start up while the windows are
+ * built; takes the key file */
+static Layout*
+layout_new(GKeyFile* file)
+{
+    Layout* layout = g_new0(Layout, 1);
+    gsize i;
+
+    layout->file = file;
+    layout->groups = g_key_file_get_groups(layout->file, &layout->count);
+    layout->ptys = g_new0(VtePty*, layout->count);
+    layout->pids = g_new0(GPid, layout->count);
+    layout->terms = g_new0(TinyTerm*, layout->count);
+    for (i = 0; i < layout->count; i++) {
+        char* command = layout_get_string(layout, i, "command");
+        char* directory = layout_get_path(layout, i, "directory");
+
+        if (!pty_spawn(directory, command, NULL, LAYOUT_ROWS, LAYOUT_COLUMNS, &layout->ptys[i], &layout->pids[i]))
+            layout->ptys[i] = NULL;
+        g_free(command);
+        g_free(directory);
+    }
+    timing_mark("layout: children spawned");
+    return layout;
+}
+
+/* load a --layout file and spawn its children, NULL on failure */
+static Layout*
+layout_load(const char* path)
+{
+    GKeyFile* file = g_key_file_new();
+    GError* error = NULL;
+
+    if (!g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, &error)) {
+        g_printerr("Failed to load %s: %s\n", path, error->message);
+        g_error_free(error);
+        g_key_file_free(file);
+        return NULL;
+    }
+    return layout_new(file);
+}
+
+static void
+layout_free(Layout* layout)
+{
+    g_key_file_free(layout->file);
+    g_strfreev(layout->groups);
+    g_free(layout->ptys);
+    g_free(layout->pids);
+    g_free(layout->terms);
+    g_free(layout);
+}
+
+/* build the windows of a layout around the spawned children and show them, FALSE if there is none;
+ * the panes of a window are tabs unless split=right or split=down puts them beside the previous
+ * one, or beside the pane of the group named by split-of */
+static gboolean
+layout_open(Layout* layout)
+{
+    GHashTable* windows = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);  // last pane by window
+    GList* firsts = NULL;
+    GList* l;
+    gsize i, j;
+
+    for (i = 0; i < layout->count; i++) {
+        char* window = layout_get_string(layout, i, "window");
+        char* split = layout_get_string(layout, i, "split");
+        char* split_of = layout_get_string(layout, i, "split-of");
+        char* log = layout_get_path(layout, i, "log");
+        TinyTerm* last;
+        TinyTerm* term;
+
+        if (!layout->ptys[i]) {
+            g_free(window);
+            g_free(split);
+            g_free(split_of);
+            g_free(log);
+            continue;
+        }
+        if (!window)
+            window = g_strdup(layout->groups[i]);
+        if (!(last = g_hash_table_lookup(windows, window))) {
+            /* the first pane of a window sets its options */
+            TinyTermOptions options = { NULL };
+            options.title = layout_get_string(layout, i, "title");
+            options.name = layout_get_string(layout, i, "name");
+            options.keep = g_key_file_get_boolean(layout->file, layout->groups[i], "keep", NULL);
+            options.predict = g_key_file_get_boolean(layout->file, layout->groups[i], "predict", NULL);
+            term = terminal_pane_create(window_new(&options));
+            g_free(options.title);
+            g_free(options.name);
+        } else {
+            term = terminal_pane_create(last->win);
+        }
+        terminal_attach(term, layout->ptys[i], layout->pids[i], LAYOUT_ROWS, LAYOUT_COLUMNS);
+        term->command = layout_get_string(layout, i, "command");
+        terminals = g_list_prepend(terminals, term);
+        term->win->panes = g_list_append(term->win->panes, term);
+        layout->terms[i] = term;
+        if (last && split && split_of) {
+            for (j = 0; j < i && g_strcmp0(layout->groups[j], split_of) != 0; j++)
+                ;
+            if (j < i && layout->terms[j] && layout->terms[j]->win == term->win)
+                last = layout->terms[j];
+        }
+        if (!last) {
+            window_add_pane(term->win, term);
+            firsts = g_list_append(firsts, term);
+        } else if (split) {
+            terminal_split_add(last, term, !strcmp(split, "down"));
+        } else {
+            terminal_tab_add(last, term);
+        }
+        if (log)
+            term->log = log_open(log);
+        g_hash_table_replace(windows, window, term);
+        g_free(split);
+        g_free(split_of);
+        g_free(log);
+    }
+    timing_mark("layout: windows built");
+
+    /* every window starts out with its first tab */
+    for (l = firsts; l; l = l->next) {
+        TinyTerm* term = l->data;
+        gtk_notebook_set_current_page(GTK_NOTEBOOK (term->win->notebook), 0);
+        gtk_widget_grab_focus(GTK_WIDGET (term->vte));
+        terminal_show(term);
+    }
+    g_hash_table_destroy(windows);
+    if (!firsts)
+        return FALSE;
+    g_list_free(firsts);
+    return TRUE;
+}
+
+/* records of a session file, after SESSION_MAGIC, each compressed on its own; the last layout
+ * and the last screen of a pane count, the history records of a pane add up */
+enum { SESSION_LAYOUT, SESSION_HISTORY, SESSION_SCREEN };
+typedef struct {
+    guint32 type;
+    guint32 pane;           // TinyTerm.session_id, 0 for the layout
+    guint32 rows;           // history rows in the text
+    guint32 size;           // bytes of zlib data following the header
+    guint32 length;         // bytes of text they inflate to
+} SessionRecord;
+
+/* records of a restored pane in the mapped session file */
+struct _SessionRestore {
+    GMappedFile* file;
+    GArray* history;        // offsets of the history records, oldest first
+    gsize screen;           // offset of the last screen record, 0 if none
+    glong rows;             // history rows in the records
+    gsize history_length, screen_length;    // bytes of text in them
+};
+
+/* a record for the session writer, either text to compress or one to copy from a restored file */
+typedef struct {
+    SessionRecord record;
+    char* text;
+    GMappedFile* file;
+    gsize offset;
+} SessionItem;
+
+/* the records of a snapshot */
+typedef struct {
+    gboolean is_rewrite;    // the records start a new file
+    gboolean is_complete;   // the new file has all history, it replaces the old one
+    GPtrArray* items;
+} SessionJob;
+
+static char* session_path = NULL;
+static char* session_new_path = NULL;   // rewritten file until it is complete
+static int session_fd = -1;             // file appended to, only used by the writer
+static GThreadPool* session_pool = NULL;
+static char* session_layout_text = NULL;    // text of the last layout record
+static gboolean is_session_rewrite_due = TRUE;
+static gboolean is_session_rewriting = FALSE;   // a new file is written until it caught up with all history
+static gsize session_length = 0;        // bytes of text in the file
+static gsize session_live = 0;          // of them still current
+static guint session_catch_up_source = 0;
+static volatile gint session_has_failed = FALSE;   // set by the writer, the next snapshot starts over
+
+static void
+session_restore_free(SessionRestore* restore)
+{
+    g_mapped_file_unref(restore->file);
+    g_array_free(restore->history, TRUE);
+    g_free(restore);
+}
+
+static void
+session_item_free(SessionItem* item)
+{
+    if (item->file)
+        g_mapped_file_unref(item->file);
+    g_free(item->text);
+    g_free(item);
+}
+
+/* run all of a buffer through zlib, appending the result; FALSE on error */
+static gboolean
+session_convert(GConverter* converter, const char* data, gsize len, GByteArray* out)
+{
+    GConverterResult result;
+
+    do {
+        GError* error = NULL;
+        gsize bytes_read, bytes_written, offset = out->len;
+
+        g_byte_array_set_size(out, offset + SESSION_CHUNK_SIZE);
+        result = g_converter_convert(converter, data, len, out->data + offset, SESSION_CHUNK_SIZE,
+                                     G_CONVERTER_INPUT_AT_END, &bytes_read, &bytes_written, &error);
+        if (result == G_CONVERTER_ERROR) {
+            g_printerr("Failed to convert session record: %s\n", error->message);
+            g_error_free(error);
+            g_byte_array_set_size(out, offset);
+            return FALSE;
+        }
+        g_byte_array_set_size(out, offset + bytes_written);
+        data += bytes_read;
+        len -= bytes_read;
+    } while (result != G_CONVERTER_FINISHED);
+    return TRUE;
+}
+
+/* inflate a record of a restored session file, appending its text */
+static gboolean
+session_inflate(GMappedFile* file, gsize offset, GString* text)
+{
+    const char* data = g_mapped_file_get_contents(file) + offset;
+    GConverter* decompressor = G_CONVERTER (g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+    GByteArray* out = g_byte_array_new();
+    SessionRecord record;
+    gboolean is_ok;
+
+    memcpy(&record, data, sizeof(record));
+    is_ok = session_convert(decompressor, data + sizeof(record), record.size, out);
+    if (is_ok)
+        g_string_append_len(text, (const char*) out->data, out->len);
+    g_byte_array_free(out, TRUE);
+    g_object_unref(decompressor);
+    return is_ok;
+}
+
+static gboolean
+session_write_all(const guint8* data, gsize len)
+{
+    while (len > 0) {
+        ssize_t n = write(session_fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            g_printerr("Failed to write session: %s\n", g_strerror(errno));
+            return FALSE;
+        }
+        data += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+/* worker thread: compress the records of a snapshot and append them to the session file in one write */
+static void
+session_writer(SessionJob* job, gpointer data)
+{
+    GByteArray* out = g_byte_array_new();
+    guint i;
+
+    if (job->is_rewrite) {
+        if (session_fd >= 0)
+            close(session_fd);
+        session_fd = open(session_new_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+        if (session_fd < 0)
+            g_printerr("Failed to open %s: %s\n", session_new_path, g_strerror(errno));
+        g_byte_array_append(out, (const guint8*) SESSION_MAGIC, strlen(SESSION_MAGIC));
+    }
+    for (i = 0; i < job->items->len; i++) {
+        SessionItem* item = g_ptr_array_index(job->items, i);
+        gsize header = out->len;
+
+        if (item->file) {
+            g_byte_array_append(out, (const guint8*) g_mapped_file_get_contents(item->file) + item->offset,
+                                sizeof(SessionRecord) + item->record.size);
+            continue;
+        }
+        GConverter* compressor = G_CONVERTER (g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, -1));
+        g_byte_array_set_size(out, header + sizeof(SessionRecord));
+        if (session_convert(compressor, item->text, item->record.length, out)) {
+            item->record.size = out->len - header - sizeof(SessionRecord);
+            memcpy(out->data + header, &item->record, sizeof(SessionRecord));
+        } else {
+            g_byte_array_set_size(out, header);
+        }
+        g_object_unref(compressor);
+    }
+    if (session_fd >= 0 && !session_write_all(out->data, out->len)) {
+        close(session_fd);
+        session_fd = -1;
+    }
+    if (session_fd < 0)
+        g_atomic_int_set(&session_has_failed, TRUE);
+    /* the old file stays until the new one is complete and on disk */
+    if (job->is_complete && session_fd >= 0 && (fdatasync(session_fd) != 0 || rename(session_new_path, session_path) != 0))
+        g_printerr("Failed to replace %s: %s\n", session_path, g_strerror(errno));
+    g_byte_array_free(out, TRUE);
+    g_ptr_array_free(job->items, TRUE);
+    g_free(job);
+}
+
+/* add text to the records of a snapshot, taking it; returns its length */
+static gsize
+session_add_text(SessionJob* job, guint type, guint pane, glong rows, char* text)
+{
+    SessionItem* item = g_new0(SessionItem, 1);
+
+    item->record.type = type;
+    item->record.pane = pane;
+    item->record.rows = rows;
+    item->record.length = strlen(text);
+    item->text = text;
+    g_ptr_array_add(job->items, item);
+    session_length += item->record.length;
+    return item->record.length;
+}
+
+/* add rows of a pane, copied out of vte, to the records of a snapshot; returns the bytes of text */
+static gsize
+session_add_rows(SessionJob* job, guint type, TinyTerm* term, glong first_row, glong rows)
+{
+    char* text = vte_terminal_get_text_range(term->vte, first_row, 0, first_row + rows - 1,
+                                             vte_terminal_get_column_count(term->vte) - 1, NULL, NULL, NULL);
+
+    return session_add_text(job, type, term->session_id, type == SESSION_HISTORY ? rows : 0, text);
+}
+
+/* add a record of a restored session file to the records of a snapshot, copied as it is */
+static void
+session_add_copy(SessionJob* job, GMappedFile* file, gsize offset)
+{
+    SessionItem* item = g_new0(SessionItem, 1);
+
+    memcpy(&item->record, g_mapped_file_get_contents(file) + offset, sizeof(SessionRecord));
+    item->file = g_mapped_file_ref(file);
+    item->offset = offset;
+    g_ptr_array_add(job->items, item);
+    session_length += item->record.length;
+}
+
+/* the pane of a window packed first in a tab or split */
+static TinyTerm*
+session_first_pane(TinyTermWindow* win, GtkWidget* widget)
+{
+    GList* l;
+
+    while (GTK_IS_PANED (widget))
+        widget = gtk_paned_get_child1(GTK_PANED (widget));
+    for (l = win->panes; l; l = l->next) {
+        if (((TinyTerm*) l->data)->widget == widget)
+            return l->data;
+    }
+    return NULL;
+}
+
+/* add a pane to the layout of a session, as a group of the --layout format */
+static char*
+session_layout_pane(GKeyFile* file, TinyTerm* term, const char* window)
+{
+    char* group = g_strdup_printf("pane%u", term->session_id);
+    char* directory = terminal_get_directory(term);
+
+    g_key_file_set_string(file, group, "window", window);
+    if (term->command)
+        g_key_file_set_string(file, group, "command", term->command);
+    if (directory)
+        g_key_file_set_string(file, group, "directory", directory);
+    g_free(directory);
+    return group;
+}
+
+/* add the panes of a split to the layout of a session; its first pane is in the layout already and
+ * is split before either side is split further, which is the order layout_open rebuilds it in */
+static void
+session_layout_split(GKeyFile* file, TinyTermWindow* win, GtkWidget* widget, const char* window)
+{
+    TinyTerm* first;
+    TinyTerm* second;
+    char* group;
+    char* split_of;
+
+    if (!GTK_IS_PANED (widget))
+        return;
+    first = session_first_pane(win, gtk_paned_get_child1(GTK_PANED (widget)));
+    second = session_first_pane(win, gtk_paned_get_child2(GTK_PANED (widget)));
+    if (!first || !second)
+        return;
+    group = session_layout_pane(file, second, window);
+    split_of = g_strdup_printf("pane%u", first->session_id);
+    g_key_file_set_string(file, group, "split", GTK_IS_VPANED (widget) ? "down" : "right");
+    g_key_file_set_string(file, group, "split-of", split_of);
+    g_free(group);
+    g_free(split_of);
+    session_layout_split(file, win, gtk_paned_get_child1(GTK_PANED (widget)), window);
+    session_layout_split(file, win, gtk_paned_get_child2(GTK_PANED (widget)), window);
+}
+
+/* the layout of the windows of the daemon in the --layout format, without the pool and tmux panes */
+static char*
+session_layout(void)
+{
+    GKeyFile* file = g_key_file_new();
+    GList* windows = NULL;
+    GList* l;
+    char* text;
+
+    for (l = g_list_last(terminals); l; l = l->prev) {
+        TinyTerm* term = l->data;
+        TinyTermWindow* win = term->win;
+        GtkNotebook* notebook = GTK_NOTEBOOK (win->notebook);
+        char* window;
+        gint page;
+
+        if (g_list_find(windows, win) || g_list_find(pool, term))
+            continue;
+        windows = g_list_prepend(windows, win);
+        window = NULL;
+        for (page = 0; page < gtk_notebook_get_n_pages(notebook); page++) {
+            GtkWidget* widget = gtk_notebook_get_nth_page(notebook, page);
+            TinyTerm* first = session_first_pane(win, widget);
+            gboolean is_window_first = !window;
+            char* group;
+
+            if (!first || first->tmux_state != TMUX_PANE_NONE)
+                continue;
+            if (is_window_first)
+                window = g_strdup_printf("window%u", first->session_id);
+            group = session_layout_pane(file, first, window);
+            if (is_window_first) {
+                if (win->has_title)
+                    g_key_file_set_string(file, group, "title", gtk_window_get_title(GTK_WINDOW (win->window)));
+                g_key_file_set_boolean(file, group, "keep", win->keep);
+                g_key_file_set_boolean(file, group, "predict", win->predict);
+            }
+            g_free(group);
+            session_layout_split(file, win, widget, window);
+        }
+        g_free(window);
+    }
+    g_list_free(windows);
+    text = g_key_file_to_data(file, NULL, NULL);
+    g_key_file_free(file);
+    return text;
+}
+
+/* callback to append what changed since the last snapshot to the session file: the layout if it
+ * changed, the history the panes gained and the screens that changed, so an idle daemon writes
+ * nothing. The text is copied out of vte here and compressed and written by session_writer.
+ * Once most of the file is text that was replaced or scrolled out of the history, it is
+ * rewritten; as that copies all history, it is spread over main loop iterations */
+static gboolean
+session_snapshot_cb(gpointer is_catch_up)
+{
+    SessionJob* job = g_new0(SessionJob, 1);
+    glong rows_left = SESSION_ROWS_MAX;
+    gboolean is_behind = FALSE;
+    gsize live = 0;
+    char* layout = session_layout();
+    GList* l;
+
+    job->items = g_ptr_array_new_with_free_func((GDestroyNotify) session_item_free);
+    if (g_atomic_int_compare_and_exchange(&session_has_failed, TRUE, FALSE))
+        is_session_rewrite_due = TRUE;
+    if (is_session_rewrite_due || (!is_session_rewriting && session_length > SESSION_COMPACT_MIN
+                                   && session_length > 2 * session_live)) {
+        job->is_rewrite = TRUE;
+        is_session_rewrite_due = FALSE;
+        is_session_rewriting = TRUE;
+        session_length = 0;
+        g_free(session_layout_text);
+        session_layout_text = NULL;
+        for (l = terminals; l; l = l->next) {
+            TinyTerm* term = l->data;
+            guint i;
+
+            term->session_row = term->session_rows = 0;
+            term->session_history = term->session_screen = 0;
+            term->is_session_dirty = TRUE;
+            if (!term->restore)
+                continue;
+            for (i = 0; i < term->restore->history->len; i++)
+                session_add_copy(job, term->restore->file, g_array_index(term->restore->history, gsize, i));
+            if (term->restore->screen)
+                session_add_copy(job, term->restore->file, term->restore->screen);
+        }
+    }
+    if (g_strcmp0(layout, session_layout_text) != 0) {
+        g_free(session_layout_text);
+        session_layout_text = g_strdup(layout);
+        session_add_text(job, SESSION_LAYOUT, 0, 0, layout);
+    } else {
+        g_free(layout);
+    }
+
+    for (l = terminals; l; l = l->next) {
+        TinyTerm* term = l->data;
+        GtkAdjustment* adjustment = term->vte->adjustment;
+        glong lower = gtk_adjustment_get_lower(adjustment);
+        glong rows = vte_terminal_get_row_count(term->vte);
+        glong end = gtk_adjustment_get_upper(adjustment) - rows;    // first row of the screen
+
+        if (term->restore) {
+            live += term->restore->history_length + term->restore->screen_length;
+            continue;
+        }
+        if (term->tmux_state != TMUX_PANE_NONE || g_list_find(pool, term))
+            continue;
+        term->session_row = MAX(term->session_row, lower);
+        if (end > term->session_row && rows_left > 0) {
+            glong n = MIN(end - term->session_row, rows_left);
+            term->session_history += session_add_rows(job, SESSION_HISTORY, term, term->session_row, n);
+            term->session_row += n;
+            term->session_rows += n;
+            rows_left -= n;
+        }
+        /* the screen follows once the history before it is in the file */
+        if (term->session_row < end) {
+            is_behind = TRUE;
+        } else if (term->is_session_dirty) {
+            term->session_screen = session_add_rows(job, SESSION_SCREEN, term, end, rows);
+            term->is_session_dirty = FALSE;
+        }
+        /* history scrolled out of vte is left in the file until it is rewritten */
+        if (term->session_rows > 0)
+            live += term->session_history / term->session_rows * MIN(end - lower, term->session_rows);
+        live += term->session_screen;
+    }
+    session_live = live + strlen(session_layout_text);
+    if (is_session_rewriting && !is_behind) {
+        job->is_complete = TRUE;
+        is_session_rewriting = FALSE;
+    }
+    if (job->items->len > 0 || job->is_rewrite || job->is_complete) {
+        g_thread_pool_push(session_pool, job, NULL);
+    } else {
+        g_ptr_array_free(job->items, TRUE);
+        g_free(job);
+    }
+
+    /* what is left is copied in the following main loop iterations rather than after the interval */
+    if (is_behind && !session_catch_up_source)
+        session_catch_up_source = g_idle_add_full(G_PRIORITY_LOW, session_snapshot_cb, GINT_TO_POINTER (TRUE), NULL);
+    if (!is_catch_up)
+        return TRUE;
+    if (!is_behind)
+        session_catch_up_source = 0;
+    return is_behind;
+}
+
+/* feed a restored pane the history and screen of its snapshot, before the output of its child */
+static void
+session_restore_load(TinyTerm* term)
+{
+    SessionRestore* restore = term->restore;
+    GString* text = g_string_new(NULL);
+    GString* feed;
+    GtkAdjustment* adjustment = term->vte->adjustment;
+    glong lower, end;
+    guint i;
+
+    term->restore = NULL;
+    for (i = 0; i < restore->history->len; i++)
+        session_inflate(restore->file, g_array_index(restore->history, gsize, i), text);
+    if (restore->screen)
+        session_inflate(restore->file, restore->screen, text);
+
+    /* the child starts over on the line after the old screen */
+    while (text->len > 0 && g_ascii_isspace(text->str[text->len - 1]))
+        g_string_truncate(text, text->len - 1);
+    if (text->len > 0)
+        g_string_append_c(text, '\n');
+    feed = g_string_sized_new(text->len + text->len / 16);
+    for (i = 0; i < text->len; i++) {
+        if (text->str[i] == '\n')
+            g_string_append_c(feed, '\r');
+        g_string_append_c(feed, text->str[i]);
+    }
+    vte_terminal_feed(term->vte, feed->str, feed->len);
+
+    /* the restored history is in the file already, unless vte moved some of the old screen into it */
+    lower = gtk_adjustment_get_lower(adjustment);
+    end = gtk_adjustment_get_upper(adjustment) - vte_terminal_get_row_count(term->vte);
+    term->session_rows = MIN(restore->rows, end - lower);
+    term->session_row = lower + term->session_rows;
+    term->session_history = restore->history_length;
+    term->is_session_dirty = TRUE;
+    g_string_free(feed, TRUE);
+    g_string_free(text, TRUE);
+    session_restore_free(restore);
+}
+
+/* reopen the windows of the last snapshot of the session in the mapped file; the history of a
+ * pane is only inflated and fed to it once it is shown, see terminal_feed */
+static void
+session_restore(void)
+{
+    GMappedFile* file = g_mapped_file_new(session_path, FALSE, NULL);
+    GHashTable* restores;
+    const char* contents;
+    gsize length, offset, layout_offset = 0;
+    SessionRecord record;
+
+    if (!file)
+        return;
+    contents = g_mapped_file_get_contents(file);
+    length = g_mapped_file_get_length(file);
+    if (length < strlen(SESSION_MAGIC) || memcmp(contents, SESSION_MAGIC, strlen(SESSION_MAGIC)) != 0) {
+        g_printerr("%s is not a session file\n", session_path);
+        g_mapped_file_unref(file);
+        return;
+    }
+    restores = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) session_restore_free);
+    for (offset = strlen(SESSION_MAGIC); offset + sizeof(record) <= length; offset += sizeof(record) + record.size) {
+        SessionRestore* restore;
+
+        memcpy(&record, contents + offset, sizeof(record));
+        if (record.size > length - offset - sizeof(record))
+            break;  // cut short by a crash
+        if (record.type == SESSION_LAYOUT) {
+            layout_offset = offset;
+            continue;
+        }
+        if (!(restore = g_hash_table_lookup(restores, GUINT_TO_POINTER (record.pane)))) {
+            restore = g_new0(SessionRestore, 1);
+            restore->file = g_mapped_file_ref(file);
+            restore->history = g_array_new(FALSE, FALSE, sizeof(gsize));
+            g_hash_table_insert(restores, GUINT_TO_POINTER (record.pane), restore);
+        }
+        if (record.type == SESSION_HISTORY) {
+            g_array_append_val(restore->history, offset);
+            restore->rows += record.rows;
+            restore->history_length += record.length;
+        } else if (record.type == SESSION_SCREEN) {
+            restore->screen = offset;
+            restore->screen_length = record.length;
+        }
+    }
+
+    if (layout_offset) {
+        GString* text = g_string_new(NULL);
+        GKeyFile* keys = g_key_file_new();
+
+        if (session_inflate(file, layout_offset, text)
+                && g_key_file_load_from_data(keys, text->str, text->len, G_KEY_FILE_NONE, NULL)) {
+            Layout* layout = layout_new(keys);
+            gsize i;
+
+            layout_open(layout);
+            for (i = 0; i < layout->count; i++) {
+                TinyTerm* term = layout->terms[i];
+                guint id;
+
+                if (!term || !g_str_has_prefix(layout->groups[i], "pane"))
+                    continue;
+                id = g_ascii_strtoull(layout->groups[i] + strlen("pane"), NULL, 10);
+                term->session_id = id;
+                session_last_id = MAX(session_last_id, id);
+                if ((term->restore = g_hash_table_lookup(restores, GUINT_TO_POINTER (id))))
+                    g_hash_table_steal(restores, GUINT_TO_POINTER (id));
+            }
+            layout_free(layout);
+        } else {
+            g_key_file_free(keys);
+        }
+        g_string_free(text, TRUE);
+    }
+    timing_mark("session restored");
+    g_hash_table_destroy(restores);
+    g_mapped_file_unref(file);
+}
+
+/* snapshot the windows of the daemon every TINYTERM_SESSION_INTERVAL, after reopening the ones
+ * of the last snapshot for --restore */
+static void
+session_init(void)
+{
+    #ifdef TINYTERM_SESSION_FILE
+    char* dir;
+
+    session_path = g_build_filename(g_get_user_data_dir(), TINYTERM_SESSION_FILE, NULL);
+    session_new_path = g_strconcat(session_path, ".new", NULL);
+    dir = g_path_get_dirname(session_path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+    if (is_restore)
+        session_restore();
+    session_pool = g_thread_pool_new((GFunc) session_writer, NULL, 1, FALSE, NULL);
+    g_timeout_add_seconds(TINYTERM_SESSION_INTERVAL, session_snapshot_cb, NULL);
+    #endif // TINYTERM_SESSION_FILE
+}
+
+/* callback to add one pre-spawned terminal to the pool per main loop iteration */
+static gboolean
+pool_fill_cb(gpointer data)
+{
+    TinyTermOptions options = { NULL };
+    TinyTerm* term = NULL;
+    gboolean timing = show_timing;
+
+    /* --timing only reports the windows requested by clients */
+    show_timing = FALSE;
+    options.directory = (char*) g_get_home_dir();
+    if (g_list_length(pool) < TINYTERM_POOL_SIZE)
+        term = terminal_new(&options);
+    show_timing = timing;
+    if (!term) {
+        pool_fill_source = 0;
+        return FALSE;
+    }
+
+    /* realizing the terminal loads its font, so mapping it later is cheap */
+    gtk_widget_realize(GTK_WIDGET (term->vte));
+    set_geometry_hints(term->vte);
+    pool = g_list_append(pool, term);
+    return TRUE;
+}
+
+/* callback to close the pooled terminals when no window was requested for a while */
+static gboolean
+pool_idle_cb(gpointer data)
+{
+    pool_idle_source = 0;
+    if (pool_fill_source) {
+        g_source_remove(pool_fill_source);
+        pool_fill_source = 0;
+    }
+    while (pool)
+        terminal_close(pool->data, EXIT_SUCCESS);
+    return FALSE;
+}
+
+/* refill the pool in the background and restart its idle timeout */
+static void
+pool_refill(void)
+{
+    if (TINYTERM_POOL_SIZE <= 0)
+        return;
+    if (!pool_fill_source)
+        pool_fill_source = g_idle_add_full(G_PRIORITY_LOW, pool_fill_cb, NULL, NULL);
+    if (TINYTERM_POOL_IDLE_TIMEOUT > 0) {
+        if (pool_idle_source)
+            g_source_remove(pool_idle_source);
+        pool_idle_source = g_timeout_add_seconds(TINYTERM_POOL_IDLE_TIMEOUT, pool_idle_cb, NULL);
+    }
+}
+
+/* take a pooled terminal if the request asks for the default shell in $HOME, NULL otherwise */
+static TinyTerm*
+pool_take(const TinyTermOptions* options)
+{
+    TinyTerm* term;
+
+    /* WM_CLASS can't be changed once the window is realized, a log has to start with the shell */
+    if (!pool || options->command || options->name || options->log || g_strcmp0(options->directory, g_get_home_dir()) != 0)
+        return NULL;
+
+    term = pool->data;
+    pool = g_list_delete_link(pool, pool);
+    term->win->keep = options->keep;
+    term->win->predict = options->predict;
+    if (options->predict)
+        term->predict = g_string_new(NULL);
+    if (options->title) {
+        if (term->title_handler)
+            g_signal_handler_disconnect(term->vte, term->title_handler);
+        term->title_handler = 0;
+        if (term->title_source)
+            g_source_remove(term->title_source);
+        term->title_source = 0;
+        term->win->has_title = TRUE;
+        gtk_window_set_title(GTK_WINDOW (term->win->window), options->title);
+        gtk_label_set_text(GTK_LABEL (gtk_notebook_get_tab_label(GTK_NOTEBOOK (term->win->notebook), term->widget)), options->title);
+    }
+    if (options->startup_id)
+        gtk_window_set_startup_id(GTK_WINDOW (term->win->window), options->startup_id);
+    return term;
+}
+
+/* path of the daemon socket, one per user and X display */
+static char*
+get_socket_path(void)
+{
+    const char* display = g_getenv("DISPLAY");
+    char* name = g_strdelimit(g_strconcat("tinyterm-", display ? display : "", NULL), "/", '_');
+    char* path = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+    g_free(name);
+    return path;
+}
+
+/* fill in the address of the daemon socket, FALSE if the path is too long */
+static gboolean
+get_socket_address(struct sockaddr_un* addr, const char* path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return FALSE;
+    strcpy(addr->sun_path, path);
+    return TRUE;
+}
+
+/* append one "key value" line of the client request */
+static void
+client_append_field(GString* request, const char* key, const char* value)
+{
+    char* escaped = g_strescape(value, NULL);
+    g_string_append_printf(request, "%s %s\n", key, escaped);
+    g_free(escaped);
+}
+
+/* connect to a running daemon, -1 if there is none */
+static int
+client_connect(void)
+{
+    struct sockaddr_un addr;
+    char* path = get_socket_path();
+    int fd;
+
+    if (!get_socket_address(&addr, path)) {
+        g_free(path);
+        return -1;
+    }
+    g_free(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* hand the window over to a running daemon and exit with the status of its child;
+ * returns only if no daemon is listening */
+static void
+client_run(const TinyTermOptions* options)
+{
+    GString* request;
+    char** environment;
+    char** env;
+    char reply[256];
+    FILE* file;
+    ssize_t n;
+    int fd = client_connect();
+    int status;
+
+    if (fd < 0)
+        return;
+    timing_mark("daemon connect");
+
+    request = g_string_new(NULL);
+    if (options->directory) {
+        client_append_field(request, "directory", options->directory);
+    } else {
+        char* cwd = g_get_current_dir();
+        client_append_field(request, "directory", cwd);
+        g_free(cwd);
+    }
+    if (options->command)
+        client_append_field(request, "execute", options->command);
+    if (options->name)
+        client_append_field(request, "name", options->name);
+    if (options->title)
+        client_append_field(request, "title", options->title);
+    if (options->log) {
+        char* cwd = g_get_current_dir();
+        char* log = g_path_is_absolute(options->log) ? g_strdup(options->log) : g_build_filename(cwd, options->log, NULL);
+        client_append_field(request, "log", log);
+        g_free(log);
+        g_free(cwd);
+    }
+    if (options->keep)
+        g_string_append(request, "keep\n");
+    if (options->predict)
+        g_string_append(request, "predict\n");
+    if (show_timing)
+        g_string_append(request, "timing\n");
+    environment = g_get_environ();
+    for (env = environment; *env; env++)
+        client_append_field(request, "env", *env);
+    g_strfreev(environment);
+    g_string_append(request, "open\n");
+
+    for (size_t done = 0; done < request->len; done += n) {
+        n = write(fd, request->str + done, request->len - done);
+        if (n < 0) {
+            g_printerr("Failed to send request to daemon\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    g_string_free(request, TRUE);
+
+    timing_mark("daemon request");
+
+    /* wait until the window is closed, printing the timing the daemon sends meanwhile */
+    file = fdopen(fd, "r");
+    while (file && fgets(reply, sizeof(reply), file)) {
+        if (sscanf(reply, "exit %d", &status) == 1)
+            exit(status);
+        if (g_str_has_prefix(reply, "timing: "))
+            g_printerr("%s", reply);
+    }
+    exit(EXIT_FAILURE);
+}
+
+/* print the counters of the windows of a running daemon and exit (--stats) */
+static void
+stats_run(void)
+{
+    char buffer[4096];
+    ssize_t n;
+    int fd = client_connect();
+
+    if (fd < 0) {
+        g_printerr("No tinyterm daemon running\n");
+        exit(EXIT_FAILURE);
+    }
+    if (write(fd, "stats\n", 6) != 6) {
+        g_printerr("Failed to send request to daemon\n");
+        exit(EXIT_FAILURE);
+    }
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        fwrite(buffer, 1, n, stdout);
+    close(fd);
+    exit(EXIT_SUCCESS);
+}
+
+static int
+stats_compare(const void* a, const void* b)
+{
+    guint32 x = *(const guint32*) a, y = *(const guint32*) b;
+    return x < y ? -1 : x > y;
+}
+
+/* time in ms a percentile of the recent frames of a pane took to draw */
+static gdouble
+stats_frame_percentile(TinyTerm* term, guint percent)
+{
+    guint count = MIN(term->frames, STATS_FRAMES);
+    guint32* times;
+    gdouble time;
+
+    if (count == 0)
+        return 0;
+    times = g_memdup(term->frame_times, count * sizeof(guint32));
+    qsort(times, count, sizeof(guint32), stats_compare);
+    time = times[MIN(count - 1, count * percent / 100)] / 1000.0;
+    g_free(times);
+    return time;
+}
+
+/* append the counters of the process and of every pane of every window to a report */
+static void
+stats_append(GString* report)
+{
+    GList* windows = NULL;
+    GList* l;
+    GList* p;
+    long rss = 0;
+    guint i = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+
+    if (statm) {
+        if (fscanf(statm, "%*d %ld", &rss) != 1)
+            rss = 0;
+        fclose(statm);
+    }
+    g_string_append_printf(report, "process %d: rss_bytes %ld scrollback_file_bytes %" G_GUINT64_FORMAT "\n",
+                           (int) getpid(), rss * sysconf(_SC_PAGESIZE), scrollback_file_bytes());
+
+    for (l = terminals; l; l = l->next) {
+        TinyTerm* term = l->data;
+        if (!g_list_find(windows, term->win))
+            windows = g_list_prepend(windows, term->win);
+    }
+    for (l = windows; l; l = l->next) {
+        TinyTermWindow* win = l->data;
+        guint j = 0;
+
+        g_string_append_printf(report, "window %u: %s%s\n", ++i, gtk_window_get_title(GTK_WINDOW (win->window)),
+                               win->panes && g_list_find(pool, win->panes->data) ? " (pooled)" : "");
+        for (p = win->panes; p; p = p->next) {
+            TinyTerm* term = p->data;
+            GtkAdjustment* adjustment = term->vte->adjustment;
+            g_string_append_printf(report,
+                "  pane %u: pid %d rows %ld read_bytes %" G_GUINT64_FORMAT " written_bytes %" G_GUINT64_FORMAT
+                " pending_bytes %u frames %u frames_skipped %u frame_avg_ms %.2f frame_p99_ms %.2f parse_ms %.1f"
+                " titles %u bells %u schedule %s%s\n",
+                ++j, (int) term->child_pid,
+                (glong) (gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_lower(adjustment)),
+                term->bytes_read, term->bytes_written,
+                term->output->len + term->input->len + (term->paste ? term->paste->len - term->paste_offset : 0),
+                term->frames, term->frames_skipped,
+                term->frames ? term->frame_time / 1000.0 / term->frames : 0, stats_frame_percentile(term, 99),
+                term->feed_time / 1000.0, term->titles, term->bells,
+                schedule_names[term->schedule], terminal_is_throughput(term) ? " (throughput)" : "");
+        }
+    }
+    g_list_free(windows);
+}
+
+/* keystrokes timed by --latency-probe, from the synthetic key event to the frame showing its echo */
+struct _LatencyProbe {
+    TinyTerm* term;
+    guint keys;             // keys sent so far
+    guint lost;             // keys whose echo wasn't shown within LATENCY_TIMEOUT
+    guint stage;            // last stage the current key reached
+    gboolean is_changed;    // vte changed its contents since the echo was read
+    gint64 times[LATENCY_STAGES];   // when the current key reached each stage
+    GArray* samples[LATENCY_STAGES];    // µs of each stage since the previous one, of the whole at LATENCY_KEY
+    guint timeout_source;
+};
+
+static const char* latency_stage_names[LATENCY_STAGES] = {
+    "key to presented", "key to pty write", "pty write to read", "pty read to drawn", "drawn to presented"
+};
+
+static gboolean latency_probe_key_cb(LatencyProbe* probe);
+
+/* print the latency of every stage of the keystrokes and exit */
+static void
+latency_probe_report(LatencyProbe* probe)
+{
+    guint i;
+
+    g_print("latency: %u keys, %u lost\n", probe->keys - 1, probe->lost);
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        GArray* samples = probe->samples[i];
+        guint32* times = (guint32*) samples->data;
+
+        if (samples->len == 0)
+            continue;
+        qsort(times, samples->len, sizeof(guint32), stats_compare);
+        g_print("latency: %-20s min %7.3f ms  median %7.3f ms  p99 %7.3f ms\n", latency_stage_names[i],
+                times[0] / 1000.0, times[samples->len / 2] / 1000.0, times[MIN(samples->len - 1, samples->len * 99 / 100)] / 1000.0);
+    }
+    exit(probe->keys > probe->lost ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* move on to the next key a few ms later, at a point unrelated to the last frame */
+static void
+latency_probe_next(LatencyProbe* probe)
+{
+    if (probe->timeout_source)
+        g_source_remove(probe->timeout_source);
+    probe->stage = LATENCY_STAGES;
+    probe->timeout_source = g_timeout_add(g_random_int_range(LATENCY_INTERVAL, 2 * LATENCY_INTERVAL),
+                                          (GSourceFunc) latency_probe_key_cb, probe);
+}
+
+/* callback run once the frame with the echo is drawn; the round trip to the X server returns
+ * after it has the frame, GTK 2 has no frame clock to tell when it is presented */
+static gboolean
+latency_probe_present_cb(LatencyProbe* probe)
+{
+    guint i;
+    guint32 time;
+
+    gdk_display_sync(gdk_display_get_default());
+    probe->times[LATENCY_PRESENTED] = g_get_monotonic_time();
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        time = probe->times[i ? i : LATENCY_PRESENTED] - probe->times[i ? i - 1 : LATENCY_KEY];
+        g_array_append_val(probe->samples[i], time);
+    }
+    latency_probe_next(probe);
+    return FALSE;
+}
+
+/* a key reached a stage; only the first time each stage is reached after the previous one counts */
+static void
+latency_probe_mark(guint stage)
+{
+    LatencyProbe* probe = latency_probe;
+
+    if (probe->stage + 1 != stage || (stage == LATENCY_DRAWN && !probe->is_changed))
+        return;
+    probe->times[stage] = g_get_monotonic_time();
+    probe->stage = stage;
+    probe->is_changed = FALSE;
+    if (stage == LATENCY_DRAWN)
+        g_idle_add_full(G_PRIORITY_HIGH, (GSourceFunc) latency_probe_present_cb, probe, NULL);
+}
+
+/* vte changed its contents; vte processes what it is fed later, so only a frame drawn
+ * after the echo changed the contents shows it */
+static void
+latency_probe_changed(void)
+{
+    if (latency_probe->stage == LATENCY_READ)
+        latency_probe->is_changed = TRUE;
+}
+
+/* callback to give up on a key whose echo didn't show up */
+static gboolean
+latency_probe_timeout_cb(LatencyProbe* probe)
+{
+    probe->timeout_source = 0;
+    probe->lost++;
+    latency_probe_next(probe);
+    return FALSE;
+}
+
+/* send a synthetic key event to the window, which passes it on to key_press_cb and vte like a real one */
+static void
+latency_probe_send(LatencyProbe* probe, GdkEventType type, guint keyval)
+{
+    GdkEvent* event = gdk_event_new(type);
+    GdkWindow* window = gtk_widget_get_window(probe->term->win->window);
+
+    event->any.window = g_object_ref(window);
+    event->any.send_event = TRUE;
+    if (type == GDK_KEY_PRESS) {
+        event->key.time = GDK_CURRENT_TIME;
+        event->key.keyval = keyval;
+        event->key.string = keyval == GDK_Return ? g_strdup("\r") : g_strdup_printf("%c", keyval);
+        event->key.length = 1;
+    } else {
+        event->focus_change.in = TRUE;
+    }
+    gtk_main_do_event(event);
+    gdk_event_free(event);
+}
+
+/* callback to send the next key: the letters of the alphabet and Return, which the echo program
+ * answers by moving the cursor back so the screen never scrolls */
+static gboolean
+latency_probe_key_cb(LatencyProbe* probe)
+{
+    guint keyval = probe->keys % 27 == 26 ? GDK_Return : 'a' + probe->keys % 27;
+
+    if (probe->keys++ == LATENCY_SAMPLES)
+        latency_probe_report(probe);
+    probe->timeout_source = g_timeout_add(LATENCY_TIMEOUT, (GSourceFunc) latency_probe_timeout_cb, probe);
+    probe->stage = LATENCY_KEY;
+    probe->times[LATENCY_KEY] = g_get_monotonic_time();
+    latency_probe_send(probe, GDK_KEY_PRESS, keyval);
+    return FALSE;
+}
+
+/* callback to start sending keys once the window is shown and the echo program is ready */
+static gboolean
+latency_probe_start_cb(LatencyProbe* probe)
+{
+    /* the pane has to be refreshed like a focused one, whatever the window manager does */
+    gtk_widget_grab_focus(GTK_WIDGET (probe->term->vte));
+    latency_probe_send(probe, GDK_FOCUS_CHANGE, 0);
+    latency_probe_key_cb(probe);
+    return FALSE;
+}
+
+/* time keystrokes typed into a pane (--latency-probe) */
+static void
+latency_probe_start(TinyTerm* term)
+{
+    LatencyProbe* probe = g_new0(LatencyProbe, 1);
+    guint i;
+
+    probe->term = term;
+    probe->stage = LATENCY_STAGES;
+    for (i = 0; i < LATENCY_STAGES; i++)
+        probe->samples[i] = g_array_sized_new(FALSE, FALSE, sizeof(guint32), LATENCY_SAMPLES);
+    latency_probe = probe;
+    g_timeout_add(LATENCY_START_DELAY, (GSourceFunc) latency_probe_start_cb, probe);
+}
+
+/* pending request of a client connected to the daemon */
+typedef struct {
+    GIOChannel* channel;
+    TinyTermOptions options;
+    GPtrArray* environment;
+    gboolean is_timing;     // the client was run with --timing
+} DaemonRequest;
+
+static void
+daemon_request_free(DaemonRequest* request)
+{
+    if (request->channel)
+        g_io_channel_unref(request->channel);
+    g_free(request->options.command);
+    g_free(request->options.directory);
+    g_free(request->options.name);
+    g_free(request->options.title);
+    g_free(request->options.startup_id);
+    g_free(request->options.log);
+    g_ptr_array_free(request->environment, TRUE);
+    g_free(request);
+}
+
+/* open the window described by a complete request */
+static void
+daemon_request_open(DaemonRequest* request)
+{
+    TinyTerm* term;
+    guint i;
+
+    timing_start = timing_last = g_get_monotonic_time();
+    timing_set_client(request->is_timing ? request->channel : NULL);
+    for (i = 0; i < request->environment->len; i++) {
+        const char* env = g_ptr_array_index(request->environment, i);
+        if (g_str_has_prefix(env, "DESKTOP_STARTUP_ID="))
+            request->options.startup_id = g_strdup(env + strlen("DESKTOP_STARTUP_ID="));
+    }
+    g_ptr_array_add(request->environment, NULL);
+    request->options.environment = (char**) request->environment->pdata;
+
+    term = pool_take(&request->options);
+    if (!term)
+        term = terminal_new(&request->options);
+    if (term) {
+        term->win->client = request->channel;
+        terminal_show(term);
+    } else {
+        timing_set_client(NULL);
+        g_io_channel_write_chars(request->channel, "exit 1\n", -1, NULL, NULL);
+        g_io_channel_flush(request->channel, NULL);
+        g_io_channel_unref(request->channel);
+    }
+    request->channel = NULL;
+    pool_refill();
+}
+
+/* callback to read request lines sent by a client */
+static gboolean
+daemon_client_cb(GIOChannel* channel, GIOCondition condition, DaemonRequest* request)
+{
+    char* line;
+    gsize terminator;
+    GIOStatus status;
+
+    while ((status = g_io_channel_read_line(channel, &line, NULL, &terminator, NULL)) == G_IO_STATUS_NORMAL) {
+        char* value = strchr(line, ' ');
+        line[terminator] = '\0';
+        if (value)
+            value = g_strcompress(value + 1);
+
+        if (g_str_has_prefix(line, "directory "))
+            request->options.directory = value;
+        else if (g_str_has_prefix(line, "execute "))
+            request->options.command = value;
+        else if (g_str_has_prefix(line, "name "))
+            request->options.name = value;
+        else if (g_str_has_prefix(line, "title "))
+            request->options.title = value;
+        else if (g_str_has_prefix(line, "log "))
+            request->options.log = value;
+        else if (g_str_has_prefix(line, "env "))
+            g_ptr_array_add(request->environment, value);
+        else
+            g_free(value);
+
+        if (strcmp(line, "keep") == 0)
+            request->options.keep = TRUE;
+        if (strcmp(line, "predict") == 0)
+            request->options.predict = TRUE;
+        if (strcmp(line, "timing") == 0)
+            request->is_timing = TRUE;
+        if (strcmp(line, "stats") == 0) {
+            GString* report = g_string_new(NULL);
+            stats_append(report);
+            g_io_channel_set_flags(channel, 0, NULL);
+            g_io_channel_write_chars(channel, report->str, report->len, NULL, NULL);
+            g_io_channel_flush(channel, NULL);
+            g_string_free(report, TRUE);
+            g_free(line);
+            daemon_request_free(request);
+            return FALSE;
+        }
+        if (strcmp(line, "open") == 0) {
+            g_free(line);
+            daemon_request_open(request);
+            daemon_request_free(request);
+            return FALSE;
+        }
+        g_free(line);
+    }
+    if (status == G_IO_STATUS_AGAIN)
+        return TRUE;
+    daemon_request_free(request);
+    return FALSE;
+}
+
+/* callback to accept connections on the daemon socket */
+static gboolean
+daemon_accept_cb(GIOChannel* source, GIOCondition condition, gpointer data)
+{
+    DaemonRequest* request;
+    int fd = accept4(g_io_channel_unix_get_fd(source), NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd < 0)
+        return TRUE;
+    request = g_new0(DaemonRequest, 1);
+    request->environment = g_ptr_array_new_with_free_func(g_free);
+    request->channel = g_io_channel_unix_new(fd);
+    g_io_channel_set_encoding(request->channel, NULL, NULL);
+    g_io_channel_set_flags(request->channel, G_IO_FLAG_NONBLOCK, NULL);
+    g_io_channel_set_close_on_unref(request->channel, TRUE);
+    g_io_add_watch(request->channel, G_IO_IN | G_IO_HUP | G_IO_ERR, (GIOFunc) daemon_client_cb, request);
+    return TRUE;
+}
+
+/* listen on the daemon socket, unless another daemon already does */
+static void
+daemon_listen(void)
+{
+    struct sockaddr_un addr;
+    GIOChannel* channel;
+    char* path = get_socket_path();
+    int fd;
+
+    if (!get_socket_address(&addr, path)) {
+        g_printerr("Socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        g_printerr("Failed to create socket: %s\n", g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+        g_printerr("Daemon already running on %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);   // stale socket of a daemon that died
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        g_printerr("Failed to listen on %s: %s\n", path, g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    daemon_socket = path;
+
+    channel = g_io_channel_unix_new(fd);
+    g_io_add_watch(channel, G_IO_IN, daemon_accept_cb, NULL);
+}
+
+static void
+parse_arguments(int* argc, char*** argv, TinyTermOptions* options)
+{
+    gboolean version = FALSE;   // show version?
+    const GOptionEntry entries[] = {
+        {"version",   'v', 0, G_OPTION_ARG_NONE,    &version,            "Display program version and exit.", 0},
+        {"execute",   'e', 0, G_OPTION_ARG_STRING,  &options->command,   "Execute command instead of default shell.", "COMMAND"},
+        {"directory", 'd', 0, G_OPTION_ARG_STRING,  &options->directory, "Sets the working directory for the shell (or the command specified via -e).", "PATH"},
+        {"keep",      'k', 0, G_OPTION_ARG_NONE,    &options->keep,      "Don't exit the terminal after child process exits.", 0},
+        {"predict",   0,   0, G_OPTION_ARG_NONE,    &options->predict,   "Show typed characters before they are echoed, for high-latency connections.", 0},
+        {"name",      'n', 0, G_OPTION_ARG_STRING,  &options->name,      "Set first value of WM_CLASS property; second value is always 'TinyTerm' (default: 'tinyterm')", "NAME"},
+        {"title",     't', 0, G_OPTION_ARG_STRING,  &options->title,     "Set value of WM_NAME property; disables window_title_cb (default: 'TinyTerm')", "TITLE"},
+        {"daemon",    0,   0, G_OPTION_ARG_NONE,    &is_daemon,          "Run in background and open windows requested by other tinyterm invocations.", 0},
+        {"restore",   0,   0, G_OPTION_ARG_NONE,    &is_restore,         "With --daemon, reopen the windows of the last session snapshot with their history.", 0},
+        {"timing",    0,   0, G_OPTION_ARG_NONE,    &show_timing,        "Print a breakdown of startup time to stderr.", 0},
+        {"stats",     0,   0, G_OPTION_ARG_NONE,    &show_stats,         "Print performance counters of the windows of the running daemon and exit.", 0},
+        {"latency-probe", 0, 0, G_OPTION_ARG_NONE,  &is_latency_probe,   "Time synthetic keystrokes from the key event to the frame showing their echo, print the latency and exit.", 0},
+        {"headless",  0,   0, G_OPTION_ARG_NONE,    &is_headless,        "Run the command through the terminal without showing a window, exit with its status.", 0},
+        {"dump",      0,   0, G_OPTION_ARG_FILENAME, &dump_path,         "With --headless, write scrollback and screen to FILE once the command exits; as HTML if FILE ends in .html.", "FILE"},
+        {"log",       0,   0, G_OPTION_ARG_FILENAME, &options->log,      "Append all output of the command to FILE; gzip compressed if FILE ends in .gz.", "FILE"},
+        {"layout",    0,   0, G_OPTION_ARG_FILENAME, &layout_path,       "Open the windows, tabs and splits described in FILE, with the command, directory, name and title of each pane.", "FILE"},
+        { NULL }
+    };
+
+    GError* error = NULL;
     GOptionContext* context = g_option_context_new(NULL);
     g_option_context_set_help_enabled(context, TRUE);
+    g_option_context_set_ignore_unknown_options(context, TRUE);  // left for gtk_init
     g_option_context_add_main_entries(context, entries, NULL);
-    g_option_context_parse(context, &argc, &argv, &error);
+    g_option_context_parse(context, argc, argv, &error);
     g_option_context_free(context);
 
     if (error) {
@@ -293,97 +5589,121 @@ parse_arguments(int argc, char* argv[], char** command, char** directory, gboole
         g_print("tinyterm " TINYTERM_VERSION "\n");
         exit(EXIT_SUCCESS);
     }
+
+    if (is_headless && is_daemon) {
+        g_printerr("option parsing failed: --headless and --daemon are exclusive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (dump_path && !is_headless) {
+        g_printerr("option parsing failed: --dump requires --headless\n");
+        exit(EXIT_FAILURE);
+    }
+    if (is_latency_probe && (is_headless || is_daemon)) {
+        g_printerr("option parsing failed: --latency-probe needs a window of its own\n");
+        exit(EXIT_FAILURE);
+    }
+    if (is_restore && !is_daemon) {
+        g_printerr("option parsing failed: --restore needs --daemon\n");
+        exit(EXIT_FAILURE);
+    }
+    if (layout_path && (is_headless || is_daemon || is_latency_probe)) {
+        g_printerr("option parsing failed: --layout can't be used with --headless, --daemon or --latency-probe\n");
+        exit(EXIT_FAILURE);
+    }
+    if (is_latency_probe && !options->command)
+        options->command = g_strdup(LATENCY_COMMAND);
 }
 
 /* UNIX signal handler */
 static void
 signal_handler(int signal)
 {
-    if (child_pid != 0)
-        kill(child_pid, SIGHUP);
+    GList* l;
+
+    for (l = terminals; l; l = l->next) {
+        TinyTerm* term = l->data;
+        if (term->child_pid != 0)
+            kill(term->child_pid, SIGHUP);
+    }
+    if (daemon_socket)
+        unlink(daemon_socket);
     exit(signal);
 }
 
 int
 main (int argc, char* argv[])
 {
-    GtkWidget* window;
-    GtkWidget* box;
-    GdkPixbuf* icon;
-    GtkIconTheme* icon_theme;
-    GError* error = NULL;
-
     /* Variables for parsed command-line arguments */
-    char* command = NULL;
-    char* directory = NULL;
-    gboolean keep = FALSE;
-    char* name = NULL;
-    char* title = NULL;
+    TinyTermOptions options = { NULL };
+    Layout* layout = NULL;
 
-    gtk_init(&argc, &argv);
-    parse_arguments(argc, argv, &command, &directory, &keep, &name, &title);
-
-    /* Create window */
-    window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-    g_signal_connect(window, "delete-event", gtk_main_quit, NULL);
-    gtk_window_set_wmclass(GTK_WINDOW (window), name ? name : "tinyterm", "TinyTerm");
-    gtk_window_set_title(GTK_WINDOW (window), title ? title : "TinyTerm");
-
-    /* Set window icon supplied by an icon theme */
-    icon_theme = gtk_icon_theme_get_default();
-    icon = gtk_icon_theme_load_icon(icon_theme, "terminal", 48, 0, &error);
-    if (error)
-        g_error_free(error);
-    if (icon)
-        gtk_window_set_icon(GTK_WINDOW (window), icon);
-
-    /* Create main box */
-    box = gtk_hbox_new(FALSE, 0);
-    gtk_container_add(GTK_CONTAINER (window), box);
-
-    /* Create vte terminal widget */
-    GtkWidget* vte_widget = vte_terminal_new();
-    gtk_box_pack_start(GTK_BOX (box), vte_widget, TRUE, TRUE, 0);
-    VteTerminal* vte = VTE_TERMINAL (vte_widget);
-    if (!keep)
-        g_signal_connect(vte, "child-exited", G_CALLBACK (vte_exit_cb), NULL);
-    g_signal_connect(vte, "key-press-event", G_CALLBACK (key_press_cb), NULL);
-    #ifdef TINYTERM_URGENT_ON_BELL
-    g_signal_connect(vte, "beep", G_CALLBACK (window_urgency_hint_cb), NULL);
-    g_signal_connect(window, "focus-in-event",  G_CALLBACK (window_focus_cb), NULL);
-    g_signal_connect(window, "focus-out-event", G_CALLBACK (window_focus_cb), NULL);
-    #endif // TINYTERM_URGENT_ON_BELL
-    #ifdef TINYTERM_DYNAMIC_WINDOW_TITLE
-    if (!title)
-        g_signal_connect(vte, "window-title-changed", G_CALLBACK (window_title_cb), NULL);
-    #endif // TINYTERM_DYNAMIC_WINDOW_TITLE
+    #if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);    // for the search worker and log writers
+    #endif
+    timing_start = timing_last = g_get_monotonic_time();
+    parse_arguments(&argc, &argv, &options);
+    timing_mark("parse_arguments");
+    if (show_stats)
+        stats_run();
 
-    vte_config(vte);
-    set_geometry_hints(vte);
+    /* Let a running daemon open the window; GTK options are only understood locally */
+    if (!is_daemon && !is_headless && !is_latency_probe && !layout_path && argc == 1) {
+        client_run(&options);
+        timing_mark("no daemon listening");
+    }
 
-    /* Create scrollbar */
-    #ifdef TINYTERM_SCROLLBAR_VISIBLE
-    GtkWidget* scrollbar;
-    scrollbar = gtk_vscrollbar_new(vte->adjustment);
-    gtk_box_pack_start(GTK_BOX (box), scrollbar, FALSE, FALSE, 0);
-    #endif // TINYTERM_SCROLLBAR_VISIBLE
+    config_load();
+    scrollback_dir_init();
+    #if !GLIB_CHECK_VERSION(2, 36, 0)
+    g_type_init();          // the ptys of --layout are created before gtk_init
+    #endif
+    if (layout_path && !(layout = layout_load(layout_path)))
+        exit(EXIT_FAILURE);
+    gtk_init(&argc, &argv);
+    timing_mark("gtk_init");
+    if (argc > 1) {
+        g_printerr("option parsing failed: Unknown option %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
 
-    vte_spawn(vte, directory, command, NULL);
+    if (TINYTERM_SCROLLBACK_BUDGET > 0 || TINYTERM_MEMORY_PRESSURE > 0)
+        g_timeout_add_seconds(MEMORY_CHECK_INTERVAL, memory_check_cb, NULL);
 
     /* register signal handler */
     signal(SIGHUP, signal_handler);
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    if (is_daemon) {
+        signal(SIGPIPE, SIG_IGN);   // clients may be gone when their window closes
+        is_daemon_timing = show_timing;
+        daemon_listen();
+        session_init();
+        pool_refill();
+    } else if (layout) {
+        if (!layout_open(layout))
+            exit(EXIT_FAILURE);
+        layout_free(layout);
+    } else {
+        TinyTerm* term = terminal_new(&options);
+        if (!term)
+            exit(EXIT_FAILURE);
+        if (!is_headless)
+            terminal_show(term);
+        if (is_latency_probe)
+            latency_probe_start(term);
+    }
+
     /* cleanup */
-    g_free(command);
-    g_free(directory);
-    g_free(name);
-    g_free(title);
+    g_free(options.command);
+    g_free(options.directory);
+    g_free(options.name);
+    g_free(options.title);
 
-    /* Show widgets and run main loop */
-    gtk_widget_show_all(window);
+    /* Run main loop */
     gtk_main();
 
+    if (daemon_socket)
+        unlink(daemon_socket);
     return EXIT_SUCCESS;
 }